@@ -0,0 +1,85 @@
+#!/bin/sh
+# End-to-end benchmark, run through make bench.
+#   BENCH_SCALE   corpus size multiplier (default 1, about 66 MB in total)
+#   BENCH_LEVELS  compression levels to run (default "1 5")
+#   BENCH_THREADS worker threads (default online CPUs)
+#   BENCH_DIR     work directory (default build/bench)
+# JSON goes to stdout and to $BENCH_DIR/bench.json
+set -e
+
+ZOV=${1:-build/zov}
+WORK=${BENCH_DIR:-build/bench}
+SCALE=${BENCH_SCALE:-1}
+LEVELS=${BENCH_LEVELS:-"1 5"}
+THREADS=${BENCH_THREADS:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)}
+CC=${CC:-cc}
+
+mkdir -p "$WORK"
+$CC -O2 -o "$WORK/benchtool" bench/benchtool.c
+TOOL=$WORK/benchtool
+
+# corpus name and size in MB before scaling
+CORPORA="text:8 logs:8 binary:8 tiny:2 huge:32 random:8"
+
+# Corpora are deterministic, rebuild only when the scale changes
+if [ "$(cat "$WORK/corpus/.scale" 2>/dev/null)" != "$SCALE" ]; then
+	rm -rf "$WORK/corpus"
+	mkdir -p "$WORK/corpus"
+	for spec in $CORPORA; do
+		name=${spec%%:*}
+		"$TOOL" gen "$name" "$WORK/corpus/$name" $(( ${spec##*:} * SCALE * 1048576 ))
+	done
+	echo "$SCALE" > "$WORK/corpus/.scale"
+fi
+
+# phase <name> <bytes> <files> <command...>: one JSON object, "ok" from the exit status
+phase(){
+	phase_name=$1 phase_bytes=$2 phase_files=$3
+	shift 3
+	set -- $("$TOOL" run "$@")
+	awk -v n="$phase_name" -v s="$1" -v rss="$2" -v rc="$3" -v b="$phase_bytes" -v f="$phase_files" 'BEGIN {
+		if(s <= 0) s = 1e-6
+		printf "\"%s\": {\"seconds\": %.4f, \"mb_s\": %.2f, \"files_s\": %.1f, \"peak_rss_kb\": %d, \"ok\": %s}",
+			n, s, b / 1048576 / s, f / s, rss, rc == 0 ? "true" : "false"
+	}'
+}
+
+json=$WORK/bench.json
+{
+	printf '{\n  "zov": "%s",\n  "threads": %s,\n  "scale": %s,\n  "results": [' \
+		"$("$ZOV" V | head -1)" "$THREADS" "$SCALE"
+	sep=""
+	for spec in $CORPORA; do
+		name=${spec%%:*}
+		src=$WORK/corpus/$name
+		files=$(find "$src" -type f | wc -l | tr -d ' ')
+		bytes=$(find "$src" -type f -exec cat {} + | wc -c | tr -d ' ')
+		for level in $LEVELS; do
+			archive=$WORK/$name.zov
+			out=$WORK/out
+			rm -rf "$archive" "$out"
+
+			printf '%s\n    {"corpus": "%s", "level": %s, "files": %s, "bytes": %s,\n     ' \
+				"$sep" "$name" "$level" "$files" "$bytes"
+			phase create "$bytes" "$files" "$ZOV" -j"$THREADS" -l"$level" c "$archive" "$src"
+			size=$(wc -c < "$archive" | tr -d ' ')
+			printf ',\n     '
+			phase extract "$bytes" "$files" "$ZOV" -j"$THREADS" x "$archive" "$out"
+			printf ',\n     '
+			phase list "$bytes" "$files" "$ZOV" l "$archive"
+			printf ',\n     '
+			phase verify "$bytes" "$files" "$ZOV" -j"$THREADS" e "$archive"
+
+			roundtrip=false
+			diff -r "$src" "$out" >/dev/null 2>&1 && roundtrip=true
+			awk -v a="$size" -v b="$bytes" -v r="$roundtrip" 'BEGIN {
+				printf ",\n     \"archive_bytes\": %d, \"ratio\": %.4f, \"roundtrip\": %s}", a, b ? a / b : 0, r
+			}'
+			sep=","
+		done
+	done
+	printf '\n  ]\n}\n'
+} > "$json"
+
+rm -rf "$WORK/out"
+cat "$json"
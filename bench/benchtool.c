@@ -0,0 +1,216 @@
+/* Helper for bench.sh: deterministic corpora and timed runs.
+ *   benchtool gen <kind> <dir> <bytes>   write a corpus
+ *   benchtool run <command> [args...]    run it, print seconds and peak RSS */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* defines */
+#define CHUNK (1 << 16)
+#define TINY_FILES_PER_DIR 100
+
+static uint64_t state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t next(void);
+static FILE* create(const char* dir, const char* name);
+static void gen_text(FILE* out, uint64_t bytes);
+static void gen_logs(FILE* out, uint64_t bytes);
+static void gen_binary(FILE* out, uint64_t bytes);
+static void gen_random(FILE* out, uint64_t bytes);
+static int generate(const char* kind, const char* dir, uint64_t bytes);
+static int run(char* argv[]);
+
+static const char* words[] = {
+	"the", "archive", "block", "member", "stream", "of", "and", "to", "in", "compress",
+	"header", "index", "file", "size", "data", "is", "a", "with", "for", "model",
+	"context", "order", "range", "coder", "symbol", "table", "thread", "worker", "queue", "write",
+	"read", "offset", "checksum", "directory", "path", "name", "mode", "time", "entry", "frame"
+};
+
+static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+
+/* xorshift64*, the same corpus on every machine */
+uint64_t next(void){
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1Dull;
+}
+
+FILE* create(const char* dir, const char* name){
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE* out = fopen(path, "wb");
+	if(!out)
+		fprintf(stderr, "benchtool: cannot create %s: %s\n", path, strerror(errno));
+	return out;
+}
+
+/* Sentences from a small vocabulary, skewed towards the first words */
+void gen_text(FILE* out, uint64_t bytes){
+	uint64_t written = 0;
+	int column = 0;
+	for(;written < bytes;){
+		uint64_t r = next();
+		const char* word = words[(r % 40) * ((r >> 8) % 40) / 40];
+		int length = fprintf(out, "%s%s", word, (r >> 16) % 11 == 0 ? ". " : " ");
+		written += (uint64_t)length;
+		column += length;
+		if(column > 72){
+			fputc('\n', out);
+			written++;
+			column = 0;
+		}
+	}
+}
+
+/* Timestamped service log lines */
+void gen_logs(FILE* out, uint64_t bytes){
+	uint64_t written = 0, clock = 1700000000000ull;
+	for(;written < bytes;){
+		uint64_t r = next();
+		clock += r % 1500;
+		written += (uint64_t)fprintf(out, "%llu.%03llu [%s] worker-%llu %s %s id=%llu latency=%llums\n",
+			(unsigned long long)(clock / 1000), (unsigned long long)(clock % 1000), levels[r % 6],
+			(unsigned long long)((r >> 8) % 16), words[(r >> 12) % 40], words[(r >> 20) % 40],
+			(unsigned long long)((r >> 28) % 100000), (unsigned long long)((r >> 44) % 900));
+	}
+}
+
+/* Fixed-size records of counters, small deltas and floats */
+void gen_binary(FILE* out, uint64_t bytes){
+	uint32_t counter = 0;
+	uint8_t record[32];
+	for(uint64_t written = 0; written < bytes; written += sizeof(record)){
+		uint64_t r = next();
+		counter += (uint32_t)(r % 7);
+		float value = (float)(r % 100000) / 100.0f;
+		memset(record, 0, sizeof(record));
+		memcpy(record, &counter, 4);
+		memcpy(record + 4, &value, 4);
+		record[8] = (uint8_t)(r >> 32) & 0x0F;
+		memcpy(record + 16, &r, 2);
+		fwrite(record, 1, sizeof(record), out);
+	}
+}
+
+void gen_random(FILE* out, uint64_t bytes){
+	uint64_t buffer[CHUNK / 8];
+	for(uint64_t written = 0; written < bytes;){
+		for(size_t i = 0; i < CHUNK / 8; i++)
+			buffer[i] = next();
+		size_t length = (bytes - written < CHUNK) ? (size_t)(bytes - written) : CHUNK;
+		fwrite(buffer, 1, length, out);
+		written += length;
+	}
+}
+
+int generate(const char* kind, const char* dir, uint64_t bytes){
+	if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+		fprintf(stderr, "benchtool: cannot create %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+
+	/* Every kind gets its own sequence */
+	for(const char* c = kind; *c; c++)
+		state = (state ^ (uint8_t)*c) * 0x100000001B3ull;
+
+	char name[64];
+	FILE* out = NULL;
+	if(strcmp(kind, "text") == 0 || strcmp(kind, "logs") == 0 || strcmp(kind, "binary") == 0){
+		/* A handful of medium files */
+		for(int i = 0; i < 8; i++){
+			snprintf(name, sizeof(name), "%s%d.%s", kind, i, strcmp(kind, "binary") == 0 ? "bin" : "txt");
+			if(!(out = create(dir, name)))
+				return 1;
+			if(kind[0] == 't')
+				gen_text(out, bytes / 8);
+			else if(kind[0] == 'l')
+				gen_logs(out, bytes / 8);
+			else
+				gen_binary(out, bytes / 8);
+			fclose(out);
+		}
+	} else if(strcmp(kind, "tiny") == 0){
+		/* Many small files spread over subdirectories */
+		uint64_t count = bytes / 256;
+		for(uint64_t i = 0; i < count; i++){
+			if(i % TINY_FILES_PER_DIR == 0){
+				snprintf(name, sizeof(name), "%s/d%llu", dir, (unsigned long long)(i / TINY_FILES_PER_DIR));
+				mkdir(name, 0755);
+			}
+			snprintf(name, sizeof(name), "d%llu/f%llu.txt", (unsigned long long)(i / TINY_FILES_PER_DIR),
+				(unsigned long long)i);
+			if(!(out = create(dir, name)))
+				return 1;
+			gen_text(out, 16 + next() % 480);
+			fclose(out);
+		}
+	} else if(strcmp(kind, "huge") == 0){
+		/* One file well past the block size, text and logs interleaved */
+		if(!(out = create(dir, "huge.dat")))
+			return 1;
+		for(uint64_t written = 0; written < bytes; written += 1 << 20){
+			if((written >> 20) % 2)
+				gen_logs(out, 1 << 20);
+			else
+				gen_text(out, 1 << 20);
+		}
+		fclose(out);
+	} else if(strcmp(kind, "random") == 0){
+		if(!(out = create(dir, "random.bin")))
+			return 1;
+		gen_random(out, bytes);
+		fclose(out);
+	} else {
+		fprintf(stderr, "benchtool: unknown corpus '%s'\n", kind);
+		return 1;
+	}
+	return 0;
+}
+
+/* Wall time and peak RSS of the child, output silenced */
+int run(char* argv[]){
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid_t pid = fork();
+	if(pid < 0)
+		return 1;
+	if(pid == 0){
+		if(!freopen("/dev/null", "w", stdout))
+			_exit(127);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	int status = 0;
+	struct rusage usage;
+	if(wait4(pid, &status, 0, &usage) < 0)
+		return 1;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%.6f %ld %d\n", seconds, usage.ru_maxrss, WIFEXITED(status) ? WEXITSTATUS(status) : 128);
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+	if(argc >= 5 && strcmp(argv[1], "gen") == 0)
+		return generate(argv[2], argv[3], strtoull(argv[4], NULL, 10));
+	if(argc >= 3 && strcmp(argv[1], "run") == 0)
+		return run(argv + 2);
+
+	fprintf(stderr, "Usage: %s gen <text|logs|binary|tiny|huge|random> <dir> <bytes>\n", argv[0]);
+	fprintf(stderr, "       %s run <command> [args...]\n", argv[0]);
+	return 2;
+}
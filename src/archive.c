@@ -1,15 +1,52 @@
 #include "archive.h"
 
-static void process_directory(const char* base_path, const char* rel_path, 
-                      FILE* archive, uint16_t* file_count, uint64_t* total_size, int vflag);
-static void process_single_file(const char* filepath, const char* rel_path, 
-                        FILE* archive, uint16_t* file_count, uint64_t* total_size, struct stat* stat_buf, int vflag);
-static int create_directory(const char* path);
+static void archive_tree(const char* dir_path, FILE* archive, ArchiveHeader* arch_header, MemberSet* previous,
+	Cipher* cipher, int vflag, int threads, int level);
+static void create_file(const char* dir_path, const char* archive_path, const char* password, int vflag, int threads,
+	int level, ArchiveHeader* arch_header);
+static uint64_t archive_dead_space(const char* archive_path, uint64_t* archive_size);
+static Cipher* archive_unlock(const ArchiveHeader* header, const char* password, Cipher* key);
+static void visit_file(const char* filepath, const char* rel_path, struct stat* stat_buf, void* arg);
+static void process_single_file(const char* filepath, const char* rel_path, Pipeline* pipeline, struct stat* stat_buf,
+	MappedFile* loaded);
+static void record_member(Pipeline* pipeline, const FileHeader* header, uint64_t original_size, uint32_t checksum,
+	const struct stat* stat_buf, const uint8_t* digest);
+static void write_link(Pipeline* pipeline, const char* rel_path, const struct stat* stat_buf, const DedupEntry* target);
+static int pipeline_start(Pipeline* pipeline);
+static void pipeline_submit(Pipeline* pipeline, const char* filepath, const char* rel_path, struct stat* stat_buf);
+static int member_unchanged(MemberSet* previous, const Cipher* cipher, const char* filepath, const char* rel_path,
+	const struct stat* stat_buf);
+static void pipeline_next(Pipeline* pipeline);
+static void pipeline_finish(Pipeline* pipeline);
+static void* pipeline_worker(void* arg);
+static void* pipeline_writer(void* arg);
+static int encode_job(FileJob* job, DedupTable* dedup);
+static int load_job(FileJob* job, MappedFile* source);
+static int encode_block_job(FileJob* job, DedupTable* dedup);
+static void write_block_job(Pipeline* pipeline, FileJob* job);
+static void write_job(Pipeline* pipeline, FileJob* job);
+static FILE* stream_stdout(void);
+static int stream_header(Pipeline* pipeline, const char* rel_path, const struct stat* stat_buf, uint8_t is_compressed,
+	uint64_t size);
+static int stream_trailer(Pipeline* pipeline, const char* filename, uint32_t checksum);
+static void stream_large_file(const char* filepath, const char* rel_path, Pipeline* pipeline,
+	const struct stat* stat_buf);
+static int extract_stream(const char* output_dir, const char* password, int vflag, char* const* members,
+	int member_count);
+static int stream_member(FILE* archive, DirCache* dirs, const char* output_dir, const FileHeader* member,
+	int selected, const Cipher* cipher);
 static int should_compress_file(const char* filename);
-static int create_parent_dirs(const char* filepath);
 static void add_timestamp_to_file(const char* filepath);
-static size_t ppm_compress(const uint8_t* input, size_t input_size, uint8_t** output);
-static size_t ppm_decompress(const uint8_t* input, size_t input_size, uint8_t** output);
+static int extract_payload(FILE* archive, int format, const FileHeader* member, MemberSink* output, int threads,
+	const Cipher* cipher, uint32_t* checksum);
+static void* extract_worker(void* arg);
+static int extract_member(Extractor* extractor, FILE* archive, const ArchiveEntry* entry);
+static void* verify_worker(void* arg);
+static int verify_member(Verifier* verifier, FILE* archive, const ArchiveEntry* entry);
+static int member_selected(const char* filename, char* const* members, int member_count, uint8_t* matched);
+static const char* algorithm_name(uint8_t algorithm);
+static const char* member_coder(uint8_t is_compressed, uint8_t algorithm, uint64_t original_size,
+	uint64_t packed_size);
 
 long getFileSize(FILE *fd){
 	/* Check archive size */
@@ -19,614 +56,1647 @@ long getFileSize(FILE *fd){
 	return archive_size;
 }
 
+/* Member whose content is already archived, the payload is the offset of the copy */
+void write_link(Pipeline* pipeline, const char* rel_path, const struct stat* stat_buf, const DedupEntry* target){
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
+
+	strncpy(header.filename, rel_path, sizeof(header.filename) - 1);
+	header.permissions = stat_buf->st_mode;
+	header.offset = *pipeline->total_size;
+	header.algorithm = ALGO_LINK;
+	header.file_size = LINK_SIZE;
+	header.is_compressed = 1;
+
+	uint8_t link[LINK_SIZE];
+	put_le64(link, target->offset);
+	if(fseeko(pipeline->archive, (off_t)header.offset, SEEK_SET) != 0 ||
+		member_header_write(pipeline->archive, pipeline->format, &header) != 0 ||
+		fwrite(link, 1, LINK_SIZE, pipeline->archive) != LINK_SIZE){
+		fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__ - 3, rel_path, strerror(errno));
+		return;
+	}
+
+	record_member(pipeline, &header, target->extra, target->checksum, stat_buf, NULL);
+	if(pipeline->vflag == 1)
+		fprintf(stdout, "Processed: %s (duplicate) %lu bytes\n", rel_path, (unsigned long)target->extra);
+}
+
 /* Create archive from directory */
-int create_archive(const char* dir_path, const char* archive_path, const char* password, int vflag){
+int create_archive(const char* dir_path, const char* archive_path, const char* password, int vflag, int threads,
+	int level){
 	/* Check if source directory exists */
 	struct stat dir_stat;
 	if(stat(dir_path, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode))
 		printErr("%d: Error: Source directory '%s' does not exist or is not a directory\n", __LINE__ - 1, dir_path);
 
-	FILE* archive = fopen(archive_path, "wb");
+	ArchiveHeader arch_header;
+	create_file(dir_path, archive_path, password, vflag, threads, level, &arch_header);
+
+	fprintf(stdout, "Archive created successfully: %s\n", archive_path);
+	if(vflag == 1)
+		fprintf(stdout, "Total files: %lu, Archive size: %lu bytes\n", (unsigned long)arch_header.file_count,
+			(unsigned long)arch_header.total_size);
+
+	return 0;
+}
+
+/* Write a new archive of dir_path, arch_header gets its final counts */
+void create_file(const char* dir_path, const char* archive_path, const char* password, int vflag, int threads,
+	int level, ArchiveHeader* arch_header){
+	/* A fresh salt per archive, the key is derived once for all threads */
+	Cipher key;
+	memset(arch_header, 0, sizeof(ArchiveHeader));
+	arch_header->iterations = CIPHER_ITERATIONS;
+	if(password && (cipher_random(arch_header->salt, CIPHER_SALT_SIZE) != 0 ||
+		cipher_init(&key, password, arch_header->salt, arch_header->iterations, arch_header->check) != 0))
+		printErr("%d: Error: Cannot set up encryption: %s\n", __LINE__ - 2, strerror(errno));
+
+	int streamed = strcmp(archive_path, STREAM_PATH) == 0;
+	FILE* archive = streamed ? stream_stdout() : fopen(archive_path, "wb");
 	if(!archive)
 		printErr("%d: Error: Cannot create archive file '%s': %s\n", __LINE__ - 2, archive_path, strerror(errno));
 
 	/* Write archive header */
-	ArchiveHeader arch_header;
-	memcpy(arch_header.magic, MAGIC, 8);
-	arch_header.file_count = 0;
-	arch_header.total_size = sizeof(ArchiveHeader);
-	arch_header.has_password = (password != NULL) ? 1 : 0;
-
-	if(fwrite(&arch_header, sizeof(ArchiveHeader), 1, archive) != 1){
+	memcpy(arch_header->magic, MAGIC_PACKED, 8);
+	arch_header->format = FORMAT_PACKED;
+	arch_header->file_count = 0;
+	arch_header->has_password = (password != NULL) ? 1 : 0;
+	arch_header->streamed = (uint8_t)streamed;
+	arch_header->total_size = archive_header_size(arch_header);
+
+	if(archive_header_write(archive, arch_header) != 0){
 		fclose(archive);
 		printErr("%d: Error: Cannot write archive header\n", __LINE__ - 2);
 	}
 
+	archive_tree(dir_path, archive, arch_header, NULL, password ? &key : NULL, vflag, threads, level);
+
+	/* Add timestamp to archive file */
+	if(!streamed)
+		add_timestamp_to_file(archive_path);
+}
+
+/* Walk the tree into an archive opened at arch_header->total_size, then write the directory
+ * and the final header. Unchanged members of previous are listed without being touched */
+void archive_tree(const char* dir_path, FILE* archive, ArchiveHeader* arch_header, MemberSet* previous,
+	Cipher* cipher, int vflag, int threads, int level){
 	/* Process directory recursively */
 	if(vflag == 1)
 		fprintf(stdout, "Scanning directory: %s\n", dir_path);
-	process_directory(dir_path, "", archive, &arch_header.file_count, &arch_header.total_size, vflag);
 
-	if(arch_header.file_count == 0)
+	Pipeline pipeline = {0};
+	pipeline.archive = archive;
+	pipeline.file_count = &arch_header->file_count;
+	pipeline.total_size = &arch_header->total_size;
+	pipeline.vflag = vflag;
+	pipeline.threads = threads;
+	pipeline.format = arch_header->format;
+	pipeline.stream = arch_header->streamed;
+	pipeline.level = level;
+	pipeline.algorithm = codec_level(level, NULL) ? codec_level(level, NULL)->algorithm : ALGO_PPM;
+	pipeline.cipher = cipher;
+	pipeline.previous = previous;
+	pipeline.index.version = (arch_header->format == FORMAT_LEGACY) ? INDEX_VERSION_FIXED : INDEX_VERSION;
+	if(dedup_init(&pipeline.dedup) != 0 || pipeline_start(&pipeline) != 0)
+		printErr("%d: Error: Cannot start compression threads\n", __LINE__ - 1);
+
+	/* The writer appends at the current position */
+	if(!pipeline.stream && fseeko(archive, (off_t)arch_header->total_size, SEEK_SET) != 0)
+		printErr("%d: Error: Cannot seek in archive: %s\n", __LINE__ - 1, strerror(errno));
+
+	walk_tree(dir_path, threads, visit_file, &pipeline);
+	pipeline_finish(&pipeline);
+
+	/* Unchanged members keep their payload, only the directory entry is new */
+	for(uint64_t i = 0; previous && i < previous->count; i++){
+		const PreviousMember* member = &previous->members[i];
+		if(!member->unchanged)
+			continue;
+
+		FileHeader header;
+		memset(&header, 0, sizeof(FileHeader));
+		strncpy(header.filename, member->filename, sizeof(header.filename) - 1);
+		header.file_size = member->file_size;
+		header.permissions = member->permissions;
+		header.offset = member->offset;
+		header.is_compressed = member->is_compressed;
+		header.algorithm = member->algorithm;
+		if(index_add(&pipeline.index, &header, member->original_size, member->mtime, member->checksum) != 0)
+			printErr("%d: Error: Memory allocation failed for the archive index\n", __LINE__ - 1);
+		arch_header->file_count++;
+	}
+
+	if(arch_header->file_count == 0)
 		printErr("%d: Warning: No files found to archive\n", __LINE__ - 1);
 
-	/* Update header with actual counts */
-	fseek(archive, 0, SEEK_SET);
-	if(fwrite(&arch_header, sizeof(ArchiveHeader), 1, archive) != 1){
+	/* Central directory goes after the last member, a stream marks where they end */
+	uint64_t index_size = 0;
+	uint64_t clock = stats_clock();
+	if(pipeline.stream && putc(STREAM_END, archive) != EOF)
+		arch_header->total_size++;
+	else if(pipeline.stream || fseeko(archive, (off_t)arch_header->total_size, SEEK_SET) != 0){
+		fclose(archive);
+		printErr("%d: Error: Cannot write archive index\n", __LINE__ - 3);
+	}
+	if(index_write(&pipeline.index, archive, arch_header->total_size, &index_size) != 0){
+		fclose(archive);
+		printErr("%d: Error: Cannot write archive index\n", __LINE__ - 2);
+	}
+	stats_time(STAT_INDEX, clock);
+	arch_header->total_size += index_size;
+	index_free(&pipeline.index);
+	dedup_free(&pipeline.dedup);
+
+	/* Drop anything left behind by a discarded compression attempt */
+	clock = stats_clock();
+	fflush(archive);
+	if(!pipeline.stream && ftruncate(fileno(archive), (off_t)arch_header->total_size) != 0)
+		fprintf(stderr, "%d: Warning: Cannot trim archive: %s\n", __LINE__ - 1, strerror(errno));
+
+	/* Update header with actual counts, a stream has them in the directory only */
+	if(!pipeline.stream && archive_header_write(archive, arch_header) != 0){
 		fclose(archive);
 		printErr("%d: Error: Cannot update archive header\n", __LINE__ - 2);
 	}
 
-	fclose(archive);
+	if(fclose(archive) != 0)
+		printErr("%d: Error: Cannot write archive: %s\n", __LINE__ - 1, strerror(errno));
+	stats_time(STAT_SYNC, clock);
+}
 
-	/* Add timestamp to archive file */
+/* Bring an archive in line with a directory: new and changed files are appended,
+ * unchanged members stay where they are and deleted files drop out of the directory.
+ * The payloads left behind are dead space, once it reaches 1/UPDATE_DEAD_SHARE of
+ * the archive the whole tree is written to a new archive that replaces the old one */
+int update_archive(const char* dir_path, const char* archive_path, const char* password, int vflag, int threads,
+	int level, int hash){
+	struct stat dir_stat;
+	if(stat(dir_path, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode))
+		printErr("%d: Error: Source directory '%s' does not exist or is not a directory\n", __LINE__ - 1, dir_path);
+
+	IndexReader reader;
+	MemberSet previous;
+	index_open(archive_path, &reader);
+	if(members_load(&reader, &previous) != 0){
+		index_close(&reader);
+		printErr("%d: Error: Cannot read the members of %s\n", __LINE__ - 2, archive_path);
+	}
+	previous.hash = hash;
+
+	/* New members are sealed with the key the archive already has */
+	Cipher key;
+	Cipher* cipher = archive_unlock(&reader.header, password, &key);
+	if(password && !cipher)
+		fprintf(stderr, "%d: Warning: %s is not password protected, new members are not encrypted\n", __LINE__ - 1,
+			archive_path);
+
+	/* New members go over the old directory, everything below it stays */
+	ArchiveHeader arch_header = reader.header;
+	arch_header.file_count = 0;
+	arch_header.streamed = 0;
+	arch_header.total_size = reader.data_end;
+	if(!reader.has_index)
+		fprintf(stderr, "%d: Warning: %s has no central directory, every file is written again\n", __LINE__ - 1,
+			archive_path);
+	index_close(&reader);
+
+	FILE* archive = fopen(archive_path, "r+b");
+	if(!archive)
+		printErr("%d: Error: Cannot open archive file '%s': %s\n", __LINE__ - 2, archive_path, strerror(errno));
+
+	if(vflag == 1)
+		fprintf(stdout, "Updating archive: %s\n", archive_path);
+	archive_tree(dir_path, archive, &arch_header, &previous, cipher, vflag, threads, level);
 	add_timestamp_to_file(archive_path);
 
-	fprintf(stdout, "Archive created successfully: %s\n", archive_path);
+	uint64_t unchanged = 0, removed = 0;
+	for(uint64_t i = 0; i < previous.count; i++){
+		unchanged += previous.members[i].unchanged;
+		removed += !previous.members[i].present;
+	}
+	uint64_t archive_size = 0;
+	uint64_t dead = archive_dead_space(archive_path, &archive_size);
+	fprintf(stdout, "Archive updated successfully: %s (%lu unchanged, %lu written, %lu removed, %lu dead bytes)\n",
+		archive_path, (unsigned long)unchanged, (unsigned long)(arch_header.file_count - unchanged),
+		(unsigned long)removed, (unsigned long)dead);
+	members_free(&previous);
+
+	/* Members link to each other by offset, so the payloads can't be moved, the tree is
+	 * coded again. Legacy archives stay legacy, the rebuild would write the packed format */
+	if(dead == 0 || dead < archive_size / UPDATE_DEAD_SHARE || arch_header.format != FORMAT_PACKED)
+		return 0;
+
+	struct stat archive_stat;
+	char rebuilt[PATH_MAX];
+	if(stat(archive_path, &archive_stat) != 0 ||
+		snprintf(rebuilt, sizeof(rebuilt), "%s%s", archive_path, UPDATE_SUFFIX) >= (int)sizeof(rebuilt)){
+		fprintf(stderr, "%d: Warning: Cannot rebuild %s\n", __LINE__ - 2, archive_path);
+		return 0;
+	}
 	if(vflag == 1)
-		fprintf(stdout, "Total files: %d, Archive size: %lu bytes\n", arch_header.file_count, (unsigned long)arch_header.total_size);
+		fprintf(stdout, "Rebuilding archive: %s\n", archive_path);
 
+	create_file(dir_path, rebuilt, cipher ? password : NULL, vflag, threads, level, &arch_header);
+	if(chmod(rebuilt, archive_stat.st_mode & 07777) != 0 || rename(rebuilt, archive_path) != 0){
+		unlink(rebuilt);
+		printErr("%d: Error: Cannot replace %s: %s\n", __LINE__ - 2, archive_path, strerror(errno));
+	}
+	fprintf(stdout, "Archive rebuilt: %s (%lu bytes, was %lu)\n", archive_path, (unsigned long)arch_header.total_size,
+		(unsigned long)archive_size);
 	return 0;
 }
 
+/* Bytes of an archive no member of its directory owns: payloads of replaced and
+ * removed members and headers of their old copies */
+uint64_t archive_dead_space(const char* archive_path, uint64_t* archive_size){
+	IndexReader reader;
+	index_open(archive_path, &reader);
+	*archive_size = reader.archive_size;
+
+	uint64_t live = archive_header_size(&reader.header);
+	ArchiveEntry entry;
+	int next;
+	for(;(next = index_next(&reader, &entry)) > 0;)
+		live += member_header_size(reader.header.format, entry.filename) + entry.file_size;
+	uint64_t data_end = reader.data_end;
+	index_close(&reader);
+	return (next == 0 && data_end > live) ? data_end - live : 0;
+}
+
+/* Key of a password archive from its header salt, NULL for other archives */
+Cipher* archive_unlock(const ArchiveHeader* header, const char* password, Cipher* key){
+	if(!header->has_password)
+		return NULL;
+	if(!password)
+		printErr("%d: Error: Archive is password protected, give --password\n", __LINE__ - 1);
+	if(header->format != FORMAT_PACKED)
+		return NULL;
+	if(archive_key(header, password, key) != 0)
+		printErr("%d: Error: Wrong password\n", __LINE__ - 1);
+	return key;
+}
+
 /* Extract archive to directory */
-int extract_archive(const char* archive_path, const char* output_dir, const char* password, int vflag){
+int extract_archive(const char* archive_path, const char* output_dir, const char* password, int vflag, int threads,
+	char* const* members, int member_count){
+	if(strcmp(archive_path, STREAM_PATH) == 0)
+		return extract_stream(output_dir, password, vflag, members, member_count);
+
 	/* Check if archive file exists */
 	struct stat archive_stat;
 	if(stat(archive_path, &archive_stat) != 0)
 		printErr("%d: Error: Archive file '%s' does not exist\n", __LINE__ - 1, archive_path);
 
-	FILE* archive = fopen(archive_path, "rb");
-	if(!archive)
+	/* Members are found through the index, every thread reads data on its own handle */
+	Extractor extractor;
+	memset(&extractor, 0, sizeof(Extractor));
+	index_open(archive_path, &extractor.reader);
+	extractor.archive_path = archive_path;
+	extractor.output_dir = output_dir;
+	extractor.threads = threads > 1 ? threads : 1;
+	extractor.vflag = vflag;
+	extractor.members = members;
+	extractor.member_count = member_count;
+
+	if(access(archive_path, R_OK) != 0){
+		index_close(&extractor.reader);
 		printErr("%d: Error: Cannot open archive file '%s': %s\n", __LINE__ - 2, archive_path, strerror(errno));
-
-	long int archive_size = getFileSize(archive);
-
-	if(archive_size < (long)sizeof(ArchiveHeader)){
-		fclose(archive);
-		printErr("%d: Error: Archive file is too small or empty\n", __LINE__ - 2);
 	}
 
-	/* Read archive header */
-	ArchiveHeader arch_header;
-	if(fread(&arch_header, sizeof(ArchiveHeader), 1, archive) != 1) {
-		fclose(archive);
-		printErr("%d: Error: Cannot read archive header\n", __LINE__ - 2);
-	}
+	/* Password archives open with the key from their header */
+	Cipher key;
+	extractor.cipher = archive_unlock(&extractor.reader.header, password, &key);
 
-	/* Verify magic number */
-	if(memcmp(arch_header.magic, MAGIC, 8) != 0){
-		fclose(archive);
-		printErr("%d: Error: Invalid archive format - wrong magic number\n", __LINE__ - 2);
+	if(vflag == 1)
+		fprintf(stdout, "Extracting %lu files from archive...\n", (unsigned long)extractor.reader.count);
+
+	/* Names or globs given on the command line narrow the member set */
+	pthread_t* workers = calloc((size_t)extractor.threads, sizeof(pthread_t));
+	if(!workers || dircache_init(&extractor.dirs) != 0 ||
+		(member_count > 0 && !(extractor.matched = calloc((size_t)member_count, 1)))){
+		index_close(&extractor.reader);
+		printErr("%d: Error: Out of memory\n", __LINE__ - 3);
 	}
 
-	/* Check password if required */
-	if(arch_header.has_password && password == NULL){
-		fclose(archive);
-		printErr("%d: Error: Archive is password protected\n", __LINE__ - 2);
+	/* Create output directory if needed, with any missing parents */
+	char output_path[PATH_MAX];
+	snprintf(output_path, sizeof(output_path), "%s/", output_dir);
+	if(dircache_parents(&extractor.dirs, output_path) != 0){
+		index_close(&extractor.reader);
+		printErr("%d: Error: Cannot create output directory '%s': %s\n", __LINE__ - 2, output_dir, strerror(errno));
 	}
 
-	if(vflag == 1)
-		fprintf(stdout, "Extracting %d files from archive...\n", arch_header.file_count);
+	pthread_mutex_init(&extractor.lock, NULL);
+	pthread_mutex_init(&extractor.split_lock, NULL);
+
+	/* Members are spread over the threads like in verify_archive */
+	int started = 0;
+	for(;started < extractor.threads && pthread_create(&workers[started], NULL, extract_worker, &extractor) == 0;
+		started++);
+	if(started == 0)
+		extract_worker(&extractor);
+	for(int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&extractor.lock);
+	pthread_mutex_destroy(&extractor.split_lock);
+	dircache_free(&extractor.dirs);
+	free(workers);
+
+	int damaged = extractor.damaged;
+	if(damaged)
+		fprintf(stderr, "%d: Error: Cannot read file header for file %lu\n", __LINE__ - 1,
+			(unsigned long)extractor.reader.position);
+	index_close(&extractor.reader);
+
+	int missing = 0;
+	for(int i = 0; i < member_count; i++)
+		if(!extractor.matched[i]){
+			fprintf(stderr, "%d: Warning: %s: Not found in archive\n", __LINE__ - 1, members[i]);
+			missing++;
+		}
+	free(extractor.matched);
 
-	/* Create output directory if needed */
-	if(create_directory(output_dir) != 0){
-		fclose(archive);
-		printErr("%d: Error: Cannot create output directory '%s'\n", __LINE__ - 2,output_dir);
-	}
+	uint64_t extracted_count = extractor.extracted, selected_count = extractor.selected;
+	if(extracted_count != selected_count){
+		if(vflag == 1)
+			printErr("%d: Warning: Extracted %lu out of %lu files\n", __LINE__ - 1,
+				(unsigned long)extracted_count, (unsigned long)selected_count);
+	} else
+		if(vflag == 1)
+			printf("Successfully extracted %lu files to: %s\n", (unsigned long)extracted_count, output_dir);
+
+	return (extracted_count == selected_count && !damaged && missing == 0) ? 0 : -1;
+}
 
-	/* Process each file in archive */
-	int extracted_count = 0;
-	FileHeader file_header = {0};
-	for(int i = 0; i < arch_header.file_count; i++){
-		memset(&file_header, 0, sizeof(FileHeader));
-		if(fread(&file_header, sizeof(FileHeader), 1, archive) != 1){
-			fprintf(stderr, "%d: Error: Cannot read file header for file %d\n", __LINE__ - 1, i);
+/* Take selected members off the shared index until it runs out */
+void* extract_worker(void* arg){
+	Extractor* extractor = arg;
+	FILE* archive = fopen(extractor->archive_path, "rb");
+	ArchiveEntry entry;
+
+	pthread_mutex_lock(&extractor->lock);
+	for(;!extractor->damaged;){
+		int next = index_next(&extractor->reader, &entry);
+		if(next <= 0){
+			extractor->damaged |= next < 0;
 			break;
 		}
-
-		/* Validate file header */
-		if (file_header.file_size == 0) {
-			fprintf(stderr, "%d: Warning: Skipping zero-length file: %s\n", __LINE__ - 1, file_header.filename);
+		if(!member_selected(entry.filename, extractor->members, extractor->member_count, extractor->matched))
 			continue;
-		}
+		extractor->selected++;
+		pthread_mutex_unlock(&extractor->lock);
 
-		if(file_header.file_size > 100 * 1024 * 1024){ /* 100MB limit */
-			fprintf(stderr, "Warning: File too large, skipping: %s (%lu bytes)\n", file_header.filename, (unsigned long)file_header.file_size);
-			fseek(archive, file_header.file_size, SEEK_CUR);
-			continue;
+		int status = archive ? extract_member(extractor, archive, &entry) : -1;
+
+		pthread_mutex_lock(&extractor->lock);
+		if(status == 0){
+			extractor->extracted++;
+			if(extractor->vflag == 1)
+				fprintf(stdout, "Extracted: %s (%lu bytes)\n", entry.filename, (unsigned long)entry.file_size);
 		}
+	}
+	pthread_mutex_unlock(&extractor->lock);
 
-		/* Create directory structure */
-		char full_path[1024] = {0};
-		snprintf(full_path, sizeof(full_path), "%s/%s", output_dir, file_header.filename);
+	if(archive)
+		fclose(archive);
+	return NULL;
+}
 
-		if(create_parent_dirs(full_path) != 0){
-			fprintf(stderr, "Warning: Cannot create parent directories for %s\n", file_header.filename);
-			fseek(archive, file_header.file_size, SEEK_CUR);
-			continue;
-		}
+/* Write one member below the output directory, 0 once it is complete */
+int extract_member(Extractor* extractor, FILE* archive, const ArchiveEntry* entry){
+	/* Validate file header */
+	if(entry->file_size == 0){
+		fprintf(stderr, "%d: Warning: Skipping zero-length file: %s\n", __LINE__ - 1, entry->filename);
+		stats_count(STAT_SKIPPED, 1);
+		return -1;
+	}
 
-		FILE* output_file = fopen(full_path, "wb");
-		if(!output_file){
-			fprintf(stderr, "%d: Warning: Cannot create file %s: %s\n", __LINE__ - 2, full_path, strerror(errno));
-			fseek(archive, file_header.file_size, SEEK_CUR);
-			continue;
-		}
+	/* Create directory structure */
+	char full_path[PATH_MAX + sizeof(entry->filename)] = {0};
+	snprintf(full_path, sizeof(full_path), "%s/%s", extractor->output_dir, entry->filename);
 
-		/* Read compressed data */
-		uint8_t* compressed_data = calloc(file_header.file_size, sizeof(uint8_t));
-		if(!compressed_data){
-			fprintf(stderr, "%d: Error: Memory allocation failed for %s\n", __LINE__ - 1, file_header.filename);
-			fclose(output_file);
-			fseek(archive, file_header.file_size, SEEK_CUR);
-			continue;
-		}
+	if(dircache_parents(&extractor->dirs, full_path) != 0){
+		fprintf(stderr, "Warning: Cannot create parent directories for %s: %s\n", entry->filename, strerror(errno));
+		return -1;
+	}
 
-		if(fread(compressed_data, 1, file_header.file_size, archive) != file_header.file_size){
-			fprintf(stderr, "%d: Error: Cannot read file data for %s\n", __LINE__ - 1, file_header.filename);
-			free(compressed_data);
-			fclose(output_file);
-			continue;
-		}
+	/* Large members decode straight into their preallocated file, small ones
+	 * go through stdio where a mapping costs more than the copy it saves */
+	MemberSink sink = {0};
+	int fd = open(full_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if(fd >= 0 && (entry->original_size < OUTPUT_MAP_MIN || map_output(fd, entry->original_size, &sink.map) != 0) &&
+		!(sink.file = fdopen(fd, "wb")))
+		close(fd);
+	if(!sink.file && !sink.map.data){
+		fprintf(stderr, "%d: Warning: Cannot create file %s: %s\n", __LINE__ - 5, full_path, strerror(errno));
+		return -1;
+	}
 
-		/* Process data based on compression flag */
-		if(file_header.is_compressed){
-			uint8_t* decompressed_data = NULL;
-			size_t decompressed_size = ppm_decompress(compressed_data, file_header.file_size, &decompressed_data);
-
-			if(decompressed_data && decompressed_size > 0){
-			size_t written = fwrite(decompressed_data, 1, decompressed_size, output_file);
-			if(written != decompressed_size)
-				printErr("%d: Warning: Incomplete write for %s\n", __LINE__ - 2, file_header.filename);
-			free(decompressed_data);
-			} else {
-				/* Fallback: write compressed data if decompression fails */
-				fwrite(compressed_data, 1, file_header.file_size, output_file);
-				fprintf(stderr, "%d: Warning: Decompression failed for %s, storing compressed data\n", __LINE__ - 12,file_header.filename);
-			}
-		} else {
-			/* Write uncompressed data */
-			size_t written = fwrite(compressed_data, 1, file_header.file_size, output_file);
-			if(written != file_header.file_size)
-				fprintf(stderr, "%d: Warning: Incomplete write for %s\n", __LINE__ - 2, file_header.filename);
-		}
+	/* Process data based on compression flag */
+	FileHeader member;
+	memset(&member, 0, sizeof(FileHeader));
+	memcpy(member.filename, entry->filename, sizeof(member.filename));
+	member.offset = entry->offset;
+	member.file_size = entry->file_size;
+	member.is_compressed = entry->is_compressed;
+	member.algorithm = entry->algorithm;
+	uint32_t checksum = 0;
+	int format = extractor->reader.header.format;
+	int status;
+	if(entry->original_size > BLOCK_SIZE && extractor->threads > 1){
+		pthread_mutex_lock(&extractor->split_lock);
+		status = extract_payload(archive, format, &member, &sink, extractor->threads, extractor->cipher, &checksum);
+		pthread_mutex_unlock(&extractor->split_lock);
+	} else
+		status = extract_payload(archive, format, &member, &sink, 1, extractor->cipher, &checksum);
+	checksum ^= cipher_mask_name(extractor->cipher, entry->filename);
+	if(sink.map.data && sink.position != sink.map.size)
+		status = -1;
+
+	/* Damaged members are not left behind half written */
+	uint64_t clock = stats_clock();
+	int closed = sink.map.data ? (unmap_output(&sink.map) | close(fd)) : fclose(sink.file);
+	stats_time(STAT_SYNC, clock);
+	if(status != 0 || (entry->has_checksum && checksum != entry->checksum)){
+		unlink(full_path);
+		fprintf(stderr, "%d: Warning: %s failed for %s\n", __LINE__ - 2,
+			status != 0 ? "Decompression" : "Checksum verification", entry->filename);
+		stats_count(STAT_FAILED, 1);
+		return -1;
+	}
+	if(closed != 0)
+	    printErr("%d: Warning: Error closing file %s\n", __LINE__ - 10, full_path);
 
-		free(compressed_data);
+	/* Restore file permissions */
+	if(chmod(full_path, entry->permissions) != 0)
+	    fprintf(stderr, "%d: Warning: Cannot set permissions for %s: %s\n", __LINE__ - 1, full_path, strerror(errno));
 
-		if(fclose(output_file) != 0)
-		    printErr("%d: Warning: Error closing file %s\n", __LINE__ - 1, full_path);
+	/* Add extraction timestamp */
+	add_timestamp_to_file(full_path);
 
-		/* Restore file permissions */
-		if(chmod(full_path, file_header.permissions) != 0)
-		    fprintf(stderr, "%d: Warning: Cannot set permissions for %s: %s\n", __LINE__ - 1, full_path, strerror(errno));
+	stats_count(STAT_FILES, 1);
+	stats_count(STAT_BYTES_IN, entry->original_size);
+	stats_count(STAT_BYTES_OUT, entry->file_size);
+	return 0;
+}
 
-		/* Add extraction timestamp */
-		add_timestamp_to_file(full_path);
+/* Extract a streamed archive from stdin as it arrives, members one after
+ * the other. Links and the directory are never needed, the stream is read
+ * to its end so the writer on the other side of the pipe finishes cleanly */
+int extract_stream(const char* output_dir, const char* password, int vflag, char* const* members,
+	int member_count){
+	FILE* archive = stdin;
+	ArchiveHeader header;
+	if(isatty(STDIN_FILENO))
+		printErr("%d: Error: Refusing to read an archive from a terminal\n", __LINE__ - 1);
+	if(archive_header_read(archive, &header) != 0)
+		printErr("%d: Error: No archive on standard input\n", __LINE__ - 1);
+	if(!header.streamed)
+		printErr("%d: Error: Only archives created with c - can be read from standard input\n", __LINE__ - 1);
+	Cipher key;
+	const Cipher* cipher = archive_unlock(&header, password, &key);
+
+	DirCache dirs;
+	uint8_t* matched = NULL;
+	char output_path[PATH_MAX];
+	snprintf(output_path, sizeof(output_path), "%s/", output_dir);
+	if(dircache_init(&dirs) != 0 || (member_count > 0 && !(matched = calloc((size_t)member_count, 1))))
+		printErr("%d: Error: Out of memory\n", __LINE__ - 1);
+	if(dircache_parents(&dirs, output_path) != 0)
+		printErr("%d: Error: Cannot create output directory '%s': %s\n", __LINE__ - 1, output_dir, strerror(errno));
+
+	uint64_t extracted_count = 0, selected_count = 0;
+	int damaged = 0;
+	for(;;){
+		int c = getc(archive);
+		if(c == STREAM_END)
+			break;
+		FileHeader member;
+		if(c == EOF || ungetc(c, archive) == EOF || member_header_next(archive, header.format, &member) == 0){
+			damaged = 1;
+			break;
+		}
 
-		extracted_count++;
-		if(vflag == 1)
-			fprintf(stdout, "Extracted: %s (%lu bytes)\n", file_header.filename, (unsigned long)file_header.file_size);
+		int selected = member_selected(member.filename, members, member_count, matched);
+		int status = stream_member(archive, &dirs, output_dir, &member, selected, cipher);
+		selected_count += selected;
+		extracted_count += (selected && status == 0);
+		if(status < 0){
+			/* The position in the stream is lost with the member */
+			damaged = 1;
+			break;
+		}
+		if(vflag == 1 && selected && status == 0)
+			fprintf(stdout, "Extracted: %s\n", member.filename);
 	}
+	if(damaged)
+		fprintf(stderr, "%d: Error: Archive stream is damaged or cut short\n", __LINE__ - 1);
+
+	/* Directory and footer are of no use here */
+	uint8_t drain[BUFFER * 4];
+	for(;fread(drain, 1, sizeof(drain), archive) > 0;);
+	dircache_free(&dirs);
+
+	int missing = 0;
+	for(int i = 0; i < member_count; i++)
+		if(!matched[i]){
+			fprintf(stderr, "%d: Warning: %s: Not found in archive\n", __LINE__ - 1, members[i]);
+			missing++;
+		}
+	free(matched);
 
-	fclose(archive);
+	if(vflag == 1)
+		printf("Extracted %lu of %lu files to: %s\n", (unsigned long)extracted_count, (unsigned long)selected_count,
+			output_dir);
+	return (extracted_count == selected_count && !damaged && missing == 0) ? 0 : -1;
+}
 
-	if(extracted_count != arch_header.file_count){
-		if(vflag == 1)
-			printErr("%d: Warning: Extracted %d out of %d files\n", __LINE__ - 1, extracted_count, arch_header.file_count);
-	} else
-		if(vflag == 1)
-			printf("Successfully extracted %d files to: %s\n", extracted_count, output_dir);
+/* One streamed member, written out when selected and decoded into a sink
+ * otherwise. 1 when only this member failed, -1 when the stream is lost */
+int stream_member(FILE* archive, DirCache* dirs, const char* output_dir, const FileHeader* member, int selected,
+	const Cipher* cipher){
+	char full_path[PATH_MAX + sizeof(member->filename)] = {0};
+	snprintf(full_path, sizeof(full_path), "%s/%s", output_dir, member->filename);
+
+	FILE* output = NULL;
+	if(selected && dircache_parents(dirs, full_path) != 0)
+		fprintf(stderr, "Warning: Cannot create parent directories for %s: %s\n", member->filename, strerror(errno));
+	else if(selected && !(output = fopen(full_path, "wb")))
+		fprintf(stderr, "%d: Warning: Cannot create file %s: %s\n", __LINE__ - 1, full_path, strerror(errno));
+
+	/* Frames end by themselves, stored payloads have their size in the header.
+	 * A password archive frames everything, raw data in one was put there */
+	uint32_t checksum = 0;
+	int status = -1;
+	const Codec* codec = member->is_compressed ? codec_find(member->algorithm) : NULL;
+	if(!member->is_compressed && member->file_size != STREAM_SIZE_UNKNOWN && !cipher)
+		status = copy_stream(archive, output, member->file_size, NULL, &checksum);
+	else if(codec && codec->compress && codec->decode_member){
+		MemberSink sink = {0};
+		sink.file = output;
+		status = codec->decode_member(archive, member->file_size, &sink, 1, cipher, &checksum);
+	}
+
+	uint8_t trailer[STREAM_CRC_SIZE];
+	if(status == 0 && fread(trailer, 1, STREAM_CRC_SIZE, archive) != STREAM_CRC_SIZE)
+		status = -1;
+	checksum ^= cipher_mask_name(cipher, member->filename);
+	if(!output)
+		return (status != 0) ? -1 : selected;
+
+	/* Damaged members are not left behind half written */
+	off_t size = ftello(output);
+	if(fclose(output) != 0 || status != 0 || get_le32(trailer) != checksum){
+		unlink(full_path);
+		fprintf(stderr, "%d: Warning: %s failed for %s\n", __LINE__ - 2,
+			status != 0 ? "Decompression" : "Checksum verification", member->filename);
+		stats_count(STAT_FAILED, 1);
+		return (status != 0) ? -1 : 1;
+	}
 
-	return (extracted_count == arch_header.file_count) ? 0 : -1;
+	if(chmod(full_path, member->permissions) != 0)
+		fprintf(stderr, "%d: Warning: Cannot set permissions for %s: %s\n", __LINE__ - 1, full_path, strerror(errno));
+	add_timestamp_to_file(full_path);
+	stats_count(STAT_FILES, 1);
+	stats_count(STAT_BYTES_IN, size > 0 ? (uint64_t)size : 0);
+	return 0;
 }
 
-/* List archive contents */
-void list_archive_contents(const char* archive_path) {
-	FILE* archive = fopen(archive_path, "rb");
-	if(!archive)
-		printErr("%d: Error: Cannot open archive %s: %s\n", __LINE__ - 2, archive_path, strerror(errno));
+/* Decode one member's payload, links are followed to the first copy */
+int extract_payload(FILE* archive, int format, const FileHeader* member, MemberSink* output, int threads,
+	const Cipher* cipher, uint32_t* checksum){
+	if(fseeko(archive, (off_t)(member->offset + member_header_size(format, member->filename)), SEEK_SET) != 0)
+		return -1;
+
+	/* A password archive frames everything, raw data in one was put there */
+	if(!member->is_compressed)
+		return cipher ? -1 : copy_member(archive, member->file_size, output, checksum);
+	const Codec* codec = codec_find(member->algorithm);
+	if(codec && codec->decode_member)
+		return codec->decode_member(archive, member->file_size, output, threads, cipher, checksum);
+	if(member->algorithm != ALGO_LINK || member->file_size != LINK_SIZE)
+		return -1;
+
+	/* Links only ever point backwards at a member holding data */
+	uint8_t link[LINK_SIZE];
+	FileHeader target;
+	if(fread(link, 1, LINK_SIZE, archive) != LINK_SIZE)
+		return -1;
+	uint64_t offset = get_le64(link);
+	if(offset >= member->offset || member_header_read(archive, format, (off_t)offset, &target) == 0 ||
+		target.offset != offset || (target.is_compressed && target.algorithm == ALGO_LINK))
+		return -1;
+	return extract_payload(archive, format, &target, output, threads, cipher, checksum);
+}
 
-	long int archive_size = getFileSize(archive);
+/* Listing name of a member coder */
+const char* algorithm_name(uint8_t algorithm){
+	const Codec* codec = codec_find(algorithm);
+	return codec ? codec->name : "?";
+}
 
-	if(archive_size < (long)sizeof(ArchiveHeader)){
-		fclose(archive);
-		printErr("%d: Error: Archive file is empty\n", __LINE__ - 4);
-	}
+/* Coder named to the user, NULL for a stored member. Frames of a password
+ * archive or of a file over one block are kept even when every block was
+ * stored, a frame that doesn't shrink saved nothing and counts as stored */
+const char* member_coder(uint8_t is_compressed, uint8_t algorithm, uint64_t original_size, uint64_t packed_size){
+	if(!is_compressed || (algorithm != ALGO_LINK && packed_size >= original_size))
+		return NULL;
+	return algorithm_name(algorithm);
+}
 
-	ArchiveHeader arch_header;
-	if(fread(&arch_header, sizeof(ArchiveHeader), 1, archive) != 1){
-		fclose(archive);
-		printErr("%d: Error: Cannot read archive header\n", __LINE__ - 2);
+/* Member wanted by the selection, everything when there is none */
+int member_selected(const char* filename, char* const* members, int member_count, uint8_t* matched){
+	int selected = (member_count == 0);
+	for(int i = 0; i < member_count; i++){
+		size_t len = strlen(members[i]);
+		for(;len > 1 && members[i][len - 1] == '/'; len--);
+
+		/* exact name, glob, or a directory holding the member */
+		if(fnmatch(members[i], filename, 0) == 0 ||
+			(strncmp(filename, members[i], len) == 0 && (filename[len] == '\0' || filename[len] == '/'))){
+			matched[i] = 1;
+			selected = 1;
+		}
 	}
+	return selected;
+}
 
-	if(memcmp(arch_header.magic, MAGIC, 8) != 0){
-		fclose(archive);
-		printErr("%d: Error: Invalid archive format\n", __LINE__ - 2);
-	}
+/* List archive contents, only the index is read */
+void list_archive_contents(const char* archive_path) {
+	IndexReader reader;
+	index_open(archive_path, &reader);
 
 	fprintf(stdout, "Archive: %s\n", archive_path);
-	fprintf(stdout, "Files: %d\n", arch_header.file_count);
-	fprintf(stdout, "Total size: %lu bytes\n", (unsigned long)arch_header.total_size);
-	fprintf(stdout, "Password protected: %s\n", arch_header.has_password ? "yes" : "no");
+	fprintf(stdout, "Files: %lu\n", (unsigned long)reader.count);
+	fprintf(stdout, "Total size: %lu bytes\n", (unsigned long)reader.archive_size);
+	fprintf(stdout, "Password protected: %s\n", reader.header.has_password ? "yes" : "no");
 	fprintf(stdout, "\nFiles:\n");
-	fprintf(stdout, "%-50s %-12s %-10s %s\n", "Filename", "Size", "Compressed", "Permissions");
-	fprintf(stdout, "-------------------------------------------------- ------------ ---------- ----------\n");
-
-	uint64_t total_files_size = 0;
-	FileHeader file_header = {0};
-	for(int i = 0; i < arch_header.file_count; i++){
-		memset(&file_header, 0, sizeof(FileHeader));
-		if(fread(&file_header, sizeof(FileHeader), 1, archive) != 1){
-			fprintf(stderr, "%d: Error: Cannot read file header for file %d\n", __LINE__ - 1, i);
-			break;
-		}
-
-		/* Skip file data */
-		fseek(archive, file_header.file_size, SEEK_CUR);
+	fprintf(stdout, "%-50s %-12s %-12s %-10s %s\n", "Filename", "Size", "Packed", "Compressed", "Permissions");
+	fprintf(stdout, "-------------------------------------------------- ------------ ------------ ---------- ----------\n");
 
-		total_files_size += file_header.file_size;
+	uint64_t total_files_size = 0, total_packed_size = 0;
+	ArchiveEntry entry;
+	int next = 0;
+	for(;(next = index_next(&reader, &entry)) == 1;){
+		total_files_size += entry.original_size;
+		total_packed_size += entry.file_size;
 
 		/* Format permissions string */
 		char perm_str[11];
-		snprintf(perm_str, sizeof(perm_str), "%04o", file_header.permissions & 0777);
+		snprintf(perm_str, sizeof(perm_str), "%04o", entry.permissions & 0777);
+
+		const char* method = member_coder(entry.is_compressed, entry.algorithm, entry.original_size, entry.file_size);
 
-		printf("%-50s %-12lu %-10s %s\n", file_header.filename,(unsigned long)file_header.file_size,
-			file_header.is_compressed ? "PPM" : "NO", perm_str);
+		printf("%-50s %-12lu %-12lu %-10s %s\n", entry.filename, (unsigned long)entry.original_size,
+			(unsigned long)entry.file_size, method ? method : "NO", perm_str);
 	}
+	if(next < 0)
+		fprintf(stderr, "%d: Error: Cannot read file header for file %lu\n", __LINE__ - 2, (unsigned long)reader.position);
 
-	printf("-------------------------------------------------- ------------ ---------- ----------\n");
-	printf("%-50s %-12lu %-10s\n", "TOTAL", (unsigned long)total_files_size, "");
+	printf("-------------------------------------------------- ------------ ------------ ---------- ----------\n");
+	printf("%-50s %-12lu %-12lu\n", "TOTAL", (unsigned long)total_files_size, (unsigned long)total_packed_size);
 
-	fclose(archive);
+	index_close(&reader);
 }
 
-/* Verify archive integrity */
-int verify_archive(const char* archive_path) {
-	FILE* archive = fopen(archive_path, "rb");
-	if(!archive)
-		printErr("%d: Error: Cannot open archive %s\n", __LINE__ - 2, archive_path);
+/* Verify archive integrity, every member is decoded into a sink */
+int verify_archive(const char* archive_path, const char* password, int threads){
+	Verifier verifier;
+	memset(&verifier, 0, sizeof(Verifier));
+	index_open(archive_path, &verifier.reader);
+	verifier.archive_path = archive_path;
+	verifier.threads = threads > 1 ? threads : 1;
 
-	long int archive_size = getFileSize(archive);
-
-	if(archive_size < (long)sizeof(ArchiveHeader)){
-		fclose(archive); printErr("%d: Error: Archive file is too small\n", __LINE__ - 2);
-	}
-
-	ArchiveHeader arch_header;
-	if(fread(&arch_header, sizeof(ArchiveHeader), 1, archive) != 1){
-		fclose(archive);
-		printErr("%d: Error: Cannot read archive header\n", __LINE__ - 2);
-	}
-
-	if(memcmp(arch_header.magic, MAGIC, 8) != 0){
-		fclose(archive);
-		printErr("%d: Error: Invalid archive format\n", __LINE__ - 2);
-	}
+	/* Records of a password archive can only be checked with its key */
+	Cipher key;
+	verifier.cipher = archive_unlock(&verifier.reader.header, password, &key);
 
 	fprintf(stdout, "Verifying archive: %s\n", archive_path);
-	fprintf(stdout, "Files in archive: %d\n", arch_header.file_count);
-    
-	int valid_files = 0;
-	uint64_t current_offset = sizeof(ArchiveHeader);
-    
-	FileHeader file_header = {0};
-	for(int i = 0; i < arch_header.file_count; i++){
-		memset(&file_header, 0, sizeof(FileHeader));
-		if (fread(&file_header, sizeof(FileHeader), 1, archive) != 1) {
-			fprintf(stderr, "%d: Error: Cannot read file header for file %d\n", __LINE__ - 1, i);
-			break;
-		}
-
-		/* Check if offset matches */
-		if (file_header.offset != current_offset) {
-			fprintf(stderr, "%d: Warning: File offset mismatch for %s\n", __LINE__ - 1, file_header.filename);
-		}
+	fprintf(stdout, "Files in archive: %lu\n", (unsigned long)verifier.reader.count);
+
+	/* Members are spread over the threads, split members
+	 * use all of them for their blocks one at a time */
+	pthread_t* workers = calloc((size_t)verifier.threads, sizeof(pthread_t));
+	if(!workers)
+		printErr("%d: Error: Out of memory\n", __LINE__ - 2);
+	pthread_mutex_init(&verifier.lock, NULL);
+	pthread_mutex_init(&verifier.split_lock, NULL);
+
+	int started = 0;
+	for(;started < verifier.threads && pthread_create(&workers[started], NULL, verify_worker, &verifier) == 0; started++);
+	if(started == 0)
+		verify_worker(&verifier);
+	for(int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&verifier.lock);
+	pthread_mutex_destroy(&verifier.split_lock);
+	free(workers);
+
+	if(verifier.damaged)
+		fprintf(stderr, "%d: Error: Cannot read file header for file %lu\n", __LINE__ - 1,
+			(unsigned long)verifier.reader.position);
+	index_close(&verifier.reader);
+
+	if(verifier.valid == verifier.reader.count && !verifier.damaged){
+		fprintf(stdout, "Archive verification successful: all %lu files are valid\n", (unsigned long)verifier.valid);
+	} else
+		printErr("%d: Archive verification failed: %lu/%lu files valid\n", __LINE__ - 4,
+			(unsigned long)verifier.valid, (unsigned long)verifier.reader.count);
+	return 0;
+}
 
-		/* Skip file data */
-		if (fseek(archive, file_header.file_size, SEEK_CUR) != 0) {
-			printErr("%d: Error: Cannot skip file data for %s\n", __LINE__ - 1, file_header.filename);
+/* Take members off the shared index until it runs out */
+void* verify_worker(void* arg){
+	Verifier* verifier = arg;
+	FILE* archive = fopen(verifier->archive_path, "rb");
+	ArchiveEntry entry;
+
+	pthread_mutex_lock(&verifier->lock);
+	for(;!verifier->damaged;){
+		int next = index_next(&verifier->reader, &entry);
+		if(next <= 0){
+			verifier->damaged |= next < 0;
 			break;
 		}
+		pthread_mutex_unlock(&verifier->lock);
 
-		current_offset += sizeof(FileHeader) + file_header.file_size;
-		valid_files++;
+		int status = archive ? verify_member(verifier, archive, &entry) : -1;
+		stats_count(STAT_FILES, 1);
+		stats_count(status == 0 ? STAT_BYTES_IN : STAT_FAILED, status == 0 ? entry.original_size : 1);
 
-		fprintf(stdout, "  ✓ %s\n", file_header.filename);
+		pthread_mutex_lock(&verifier->lock);
+		if(status == 0){
+			verifier->valid++;
+			fprintf(stdout, "  ✓ %s\n", entry.filename);
+		}
 	}
-    
-	fclose(archive);
+	pthread_mutex_unlock(&verifier->lock);
 
-	if (valid_files == arch_header.file_count){
-		fprintf(stdout, "Archive verification successful: all %d files are valid\n", valid_files);
-	} else
-		printErr("%d: Archive verification failed: %d/%d files valid\n", __LINE__ - 4, valid_files, arch_header.file_count);
-	return 0;
+	if(archive)
+		fclose(archive);
+	return NULL;
 }
 
-/* Process directory recursively */
-void process_directory(const char* base_path, const char* rel_path, 
-                      FILE* archive, uint16_t* file_count, uint64_t* total_size, int vflag) {
-	char full_path[PATH_MAX];
-	if(strlen(rel_path) == 0)
-		snprintf(full_path, sizeof(full_path), "%s", base_path);
-	else
-		snprintf(full_path, sizeof(full_path), "%s/%s", base_path, rel_path);
+/* Member header against the index, then the payload against its checksum */
+int verify_member(Verifier* verifier, FILE* archive, const ArchiveEntry* entry){
+	FileHeader file_header;
+	int format = verifier->reader.header.format;
+	if(member_header_read(archive, format, (off_t)entry->offset, &file_header) == 0){
+		fprintf(stderr, "%d: Error: Cannot read file header for %s\n", __LINE__ - 1, entry->filename);
+		return -1;
+	}
 
-	DIR* dir = opendir(full_path);
-	if(!dir)
-		printErr("%d: Warning: Cannot open directory %s: %s\n", __LINE__, full_path, strerror(errno));
+	/* Check if offset matches */
+	if(file_header.offset != entry->offset)
+		fprintf(stderr, "%d: Warning: File offset mismatch for %s\n", __LINE__ - 1, entry->filename);
 
-	struct dirent* entry = {0};
-	for(;(entry = readdir(dir)) != NULL;){
-		/* Skip . and .. entries */
-		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) 
-			continue;
+	if((file_header.file_size != entry->file_size && file_header.file_size != STREAM_SIZE_UNKNOWN) ||
+		strncmp(file_header.filename, entry->filename, sizeof(entry->filename)) != 0){
+		fprintf(stderr, "%d: Error: Index does not match member header for %s\n", __LINE__ - 2, entry->filename);
+		return -1;
+	}
 
-		/* Build relative path */
-		char new_rel_path[PATH_MAX];
-		if(strlen(rel_path) == 0)
-			snprintf(new_rel_path, sizeof(new_rel_path), "%s", entry->d_name);
-		else
-			snprintf(new_rel_path, sizeof(new_rel_path), "%s/%s", rel_path, entry->d_name);
+	file_header.offset = entry->offset;
+	uint32_t checksum = 0;
+	int status;
+	if(entry->original_size > BLOCK_SIZE && verifier->threads > 1){
+		pthread_mutex_lock(&verifier->split_lock);
+		status = extract_payload(archive, format, &file_header, NULL, verifier->threads, verifier->cipher, &checksum);
+		pthread_mutex_unlock(&verifier->split_lock);
+	} else
+		status = extract_payload(archive, format, &file_header, NULL, 1, verifier->cipher, &checksum);
+	checksum ^= cipher_mask_name(verifier->cipher, entry->filename);
 
-		/* Build full path */
-		char entry_full_path[PATH_MAX*2];
-		snprintf(entry_full_path, sizeof(entry_full_path)*2, "%s/%s", base_path, new_rel_path);
+	if(status != 0){
+		fprintf(stderr, "%d: Error: Cannot decode %s\n", __LINE__ - 3, entry->filename);
+		return -1;
+	}
+	if(entry->has_checksum && checksum != entry->checksum){
+		fprintf(stderr, "%d: Error: Checksum mismatch for %s\n", __LINE__ - 1, entry->filename);
+		return -1;
+	}
+	return 0;
+}
 
-		struct stat stat_buf;
-		if(stat(entry_full_path, &stat_buf) != 0){
-			fprintf(stderr, "%d: Warning: Cannot stat %s: %s\n", __LINE__ - 1, entry_full_path, strerror(errno));
-			continue;
-		}
+/* Walk callback, files reach the pipeline in walk order */
+void visit_file(const char* filepath, const char* rel_path, struct stat* stat_buf, void* arg){
+	pipeline_submit((Pipeline*)arg, filepath, rel_path, stat_buf);
+}
 
-		if(S_ISDIR(stat_buf.st_mode))
-			/* Recursively process subdirectory */
-			process_directory(base_path, new_rel_path, archive, file_count, total_size, vflag);
-		else if(S_ISREG(stat_buf.st_mode))
-			/* Process regular file */
-			process_single_file(entry_full_path, new_rel_path, archive, file_count, total_size, &stat_buf, vflag);
-		else
-			printErr("%d: Error while handling files: %s", __LINE__ - 7, strerror(errno));
+/* Process single file for archiving, one read ahead comes as loaded and is taken over */
+void process_single_file(const char* filepath, const char* rel_path, Pipeline* pipeline, struct stat* stat_buf,
+	MappedFile* loaded){
+	FILE* archive = pipeline->archive;
+	int vflag = pipeline->vflag;
+	if(pipeline->stream){
+		stream_large_file(filepath, rel_path, pipeline, stat_buf);
+		return;
 	}
-    
-	closedir(dir);
-}
 
-/* Process single file for archiving */
-void process_single_file(const char* filepath, const char* rel_path, 
-                        FILE* archive, uint16_t* file_count,
-                        uint64_t* total_size, struct stat* stat_buf, int vflag) {
-	FILE* file = fopen(filepath, "rb");
-	if(!file)
+	FILE* file = loaded ? NULL : fopen(filepath, "rb");
+	if(!loaded && !file)
 		printErr("%d: Warning: Cannot open file %s: %s\n", __LINE__ - 2, filepath, strerror(errno));
     
 	/* Get file size safely */
-   	long file_size_long = getFileSize(file); 
+	struct stat st;
+	long file_size_long = loaded ? (long)loaded->size : (fstat(fileno(file), &st) == 0) ? (long)st.st_size : -1;
 
 	if(file_size_long <= 0){
-		fclose(file);
+		if(file)
+			fclose(file);
 		fprintf(stdout, "Skipped: %s (empty file)\n", rel_path);
+		stats_count(STAT_SKIPPED, 1);
 		return;
 	}
 
-	size_t file_size = (size_t)file_size_long;
-    
-	/* Read file data */
-	uint8_t* file_data = malloc(file_size); //, sizeof(uint8_t));
-	if(!file_data){
-		fclose(file);
-		printErr("%d: Error: Memory allocation failed for %s: %s\n", __LINE__ -3, filepath, strerror(errno));
-	}
-    
-	size_t bytes_read = fread(file_data, 1, file_size, file);
-	fclose(file);
-    
-	if(bytes_read != file_size){
-		free(file_data);
-		fprintf(stderr, "%d: Error: Cannot read file %s: %s\n", __LINE__ - 5, filepath, strerror(errno));
-		return;
-	}
-    
+	uint64_t file_size = (uint64_t)file_size_long;
+
 	/* Prepare file header */
-	FileHeader header = {0};
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
 
 	strncpy(header.filename, rel_path, sizeof(header.filename) - 1);
 	header.permissions = stat_buf->st_mode;
-	header.offset = *total_size;
-	header.algorithm = 1; /* PPM */
-    
-	uint8_t* compressed_data = NULL;
-	size_t compressed_size = 0;
-	int should_compress = should_compress_file(filepath);
+	header.offset = *pipeline->total_size;
+	header.algorithm = pipeline->algorithm;
+
+	/* Header is rewritten once the payload size is known */
+	off_t header_pos = (off_t)header.offset;
+	off_t payload_pos = header_pos + (off_t)member_header_size(pipeline->format, header.filename);
+	if(fseeko(archive, payload_pos, SEEK_SET) != 0){
+		if(file)
+			fclose(file);
+		else
+			map_release(loaded);
+		fprintf(stderr, "%d: Error: Cannot seek in archive for %s: %s\n", __LINE__ - 5, rel_path, strerror(errno));
+		return;
+	}
 
-	if(should_compress){
-		compressed_size = ppm_compress(file_data, file_size, &compressed_data);
+	/* Map the source when possible, otherwise stream it through stdio */
+	uint64_t clock = stats_clock();
+	MappedFile source;
+	if(loaded)
+		source = *loaded;
+	else if(map_range(fileno(file), 0, file_size, 0, &source) != 0)
+		memset(&source, 0, sizeof(MappedFile));
+	stats_time(STAT_READ, clock);
+
+	/* Identical content already in the archive becomes a link */
+	uint8_t digest[SHA256_SIZE];
+	DedupEntry target;
+	int hashed = 1;
+	clock = stats_clock();
+	if(source.data)
+		member_digest(source.data, file_size, BLOCK_SIZE, digest);
+	else
+		hashed = file_digest(fileno(file), file_size, BLOCK_SIZE, digest) == 0;
+	stats_time(STAT_HASH, clock);
+	if(hashed && dedup_find(&pipeline->dedup, DEDUP_FILE, digest, &target)){
+		map_release(&source);
+		if(file)
+			fclose(file);
+		write_link(pipeline, rel_path, stat_buf, &target);
+		return;
 	}
 
-	/* Decide whether to use compressed or original data */
-	if(compressed_data && compressed_size > 0 && compressed_size < file_size){
+	uint64_t compressed_size = 0, original_size = 0;
+	uint32_t checksum = 0;
+	uint64_t mark = dedup_mark(&pipeline->dedup);
+	int compressed = 0;
+	int hint = should_compress_file(filepath);
+	int level = pipeline->level;
+
+	/* A file of one block is one verdict, larger ones are always framed
+	 * and every block picks store, run coder or model from its own sample */
+	int framed = level != LEVEL_STORE && (file_size > BLOCK_SIZE || (source.data ?
+		data_compressible(source.data, file_size, hint) : file_compressible(fileno(file), file_size, hint)));
+
+	/* Encrypted archives frame what they store too, every byte goes into a sealed record */
+	if(!framed && pipeline->cipher){
+		level = LEVEL_STORE;
+		framed = 1;
+	}
+	if(framed && source.data)
+		compressed = compress_buffer(source.data, file_size, archive, level, &pipeline->dedup, pipeline->cipher,
+			&compressed_size, &original_size, &checksum) == 0;
+	else if(framed)
+		compressed = compress_stream(file, archive, file_size, level, &pipeline->dedup, pipeline->cipher,
+			&compressed_size, &original_size, &checksum) == 0;
+
+	/* Decide whether to use compressed or original data, split
+	 * files keep their block framing so the workers agree with us */
+	if(compressed && (compressed_size < file_size || file_size > BLOCK_SIZE || pipeline->cipher)){
 		header.file_size = compressed_size;
 		header.is_compressed = 1;
+		const char* coder = member_coder(1, header.algorithm, file_size, compressed_size);
 		if(vflag == 1)
-			fprintf(stdout, "Processed: %s (PPM) %zu -> %zu bytes\n", rel_path, file_size, compressed_size);
+			fprintf(stdout, "Processed: %s (%s) %lu -> %lu bytes\n", rel_path, coder ? coder : "store",
+				(unsigned long)file_size, (unsigned long)compressed_size);
+	} else if(pipeline->cipher){
+		/* No raw fallback in a password archive */
+		dedup_rollback(&pipeline->dedup, mark);
+		map_release(&source);
+		if(file)
+			fclose(file);
+		fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__ - 20, rel_path, strerror(errno));
+		stats_count(STAT_FAILED, 1);
+		return;
 	} else{
-		header.file_size = file_size;
+		/* Rewind both sides and store the file as is, blocks
+		 * remembered from the dropped attempt go with it */
+		dedup_rollback(&pipeline->dedup, mark);
+		uint64_t stored_size = source.size;
+		checksum = source.data ? crc32c(0, source.data, source.size) : 0;
+		if(file)
+			rewind(file);
+		clock = stats_clock();
+		if(fseeko(archive, payload_pos, SEEK_SET) != 0 ||
+			(source.data ? fwrite(source.data, 1, source.size, archive) != source.size
+				: copy_stream(file, archive, UINT64_MAX, &stored_size, &checksum) != 0)){
+			map_release(&source);
+			if(file)
+				fclose(file);
+			fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__ - 5, rel_path, strerror(errno));
+			stats_count(STAT_FAILED, 1);
+			return;
+		}
+		stats_time(STAT_WRITE, clock);
+		header.file_size = stored_size;
 		header.is_compressed = 0;
-		if(compressed_data)
-			free(compressed_data);
-		compressed_data = file_data;
-		compressed_size = file_size;
-		file_data = NULL;
+		original_size = stored_size;
 		if(vflag == 1 )
-			fprintf(stdout, "Processed: %s (store) %zu bytes\n", rel_path, file_size);
+			fprintf(stdout, "Processed: %s (store) %lu bytes\n", rel_path, (unsigned long)stored_size);
 	}
+	map_release(&source);
+	if(file)
+		fclose(file);
 
 	/* Write to archive */
-	size_t header_written = fwrite(&header, sizeof(FileHeader), 1, archive);
-	size_t data_written = fwrite(compressed_data, 1, header.file_size, archive);
+	if(fseeko(archive, header_pos, SEEK_SET) != 0 ||
+		member_header_write(archive, pipeline->format, &header) != 0 ||
+		fseeko(archive, payload_pos + (off_t)header.file_size, SEEK_SET) != 0){
+		fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__ - 1, rel_path, strerror(errno));
+		stats_count(STAT_FAILED, 1);
+	} else
+		record_member(pipeline, &header, original_size, checksum, stat_buf, hashed ? digest : NULL);
+}
 
-	if (header_written != 1 || data_written != header.file_size)
-		fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__, rel_path, strerror(errno));
-	else {
-		/* Update counters */
-		(*file_count)++;
-		*total_size += sizeof(FileHeader) + header.file_size;
+/* Count a member that made it into the archive and list it in the directory */
+void record_member(Pipeline* pipeline, const FileHeader* header, uint64_t original_size, uint32_t checksum,
+	const struct stat* stat_buf, const uint8_t* digest){
+	/* A stream can't be read back, so nothing in it is a link target */
+	if(pipeline->stream)
+		digest = NULL;
+	uint32_t masked = checksum ^ cipher_mask_name(pipeline->cipher, header->filename);
+	if(index_add(&pipeline->index, header, original_size, (uint64_t)stat_buf->st_mtime, masked) != 0 ||
+		(digest && dedup_add(&pipeline->dedup, DEDUP_FILE, digest, header->offset, original_size, checksum) != 0))
+		printErr("%d: Error: Memory allocation failed for the archive index\n", __LINE__ - 2);
+
+	(*pipeline->file_count)++;
+	*pipeline->total_size += member_header_size(pipeline->format, header->filename) + header->file_size +
+		(pipeline->stream ? STREAM_CRC_SIZE : 0);
+
+	stats_count(STAT_FILES, 1);
+	stats_count(STAT_BYTES_IN, original_size);
+	stats_count(STAT_BYTES_OUT, header->file_size);
+	if(header->is_compressed && header->algorithm == ALGO_LINK)
+		stats_count(STAT_LINKED, 1);
+	else
+		stats_count(member_coder(header->is_compressed, header->algorithm, original_size, header->file_size) ?
+			STAT_COMPRESSED : STAT_STORED, 1);
+}
+
+/* Start workers and the ordered writer. A single thread keeps a window of
+ * its own, deep enough for the reads of small files to run ahead of it */
+int pipeline_start(Pipeline* pipeline){
+	pipeline->reading = readahead_start(&pipeline->ahead) == 0;
+	pipeline->window = (pipeline->threads <= 1) ? READAHEAD_DEPTH : (size_t)pipeline->threads * JOBS_PER_THREAD;
+	pipeline->jobs = calloc(pipeline->window, sizeof(FileJob));
+	if(!pipeline->jobs)
+		return -1;
+
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->work_ready, NULL);
+	pthread_cond_init(&pipeline->job_done, NULL);
+	pthread_cond_init(&pipeline->slot_free, NULL);
+	if(pipeline->threads <= 1)
+		return 0;
+
+	pipeline->workers = calloc(pipeline->threads, sizeof(pthread_t));
+	if(!pipeline->workers)
+		return -1;
+	if(pthread_create(&pipeline->writer, NULL, pipeline_writer, pipeline) != 0)
+		return -1;
+	for(int i = 0; i < pipeline->threads; i++)
+		if(pthread_create(&pipeline->workers[i], NULL, pipeline_worker, pipeline) != 0)
+			return -1;
+	return 0;
+}
+
+/* Queue a file, blocks while the window is full */
+void pipeline_submit(Pipeline* pipeline, const char* filepath, const char* rel_path, struct stat* stat_buf){
+	/* Updating, a file that didn't change keeps its member */
+	if(pipeline->previous && member_unchanged(pipeline->previous, pipeline->cipher, filepath, rel_path, stat_buf)){
+		stats_count(STAT_UNCHANGED, 1);
+		if(pipeline->vflag == 1)
+			fprintf(stdout, "Unchanged: %s\n", rel_path);
+		return;
 	}
 
-	/* Cleanup */
-	if (compressed_data != file_data)
-		free(compressed_data);
-	if (file_data)
-		free(file_data);
+	/* Large files go out as independent blocks so all workers share them,
+	 * each block decides on its own whether it is worth coding */
+	uint64_t block_count = 1;
+	if(pipeline->threads > 1 && pipeline->level != LEVEL_STORE && stat_buf->st_size > (off_t)BLOCK_SIZE)
+		block_count = ((uint64_t)stat_buf->st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	for(uint64_t block = 0; block < block_count; block++){
+		if(pipeline->threads <= 1 && pipeline->submitted - pipeline->written >= pipeline->window)
+			pipeline_next(pipeline);
+		pthread_mutex_lock(&pipeline->lock);
+		for(;pipeline->submitted - pipeline->written >= pipeline->window;)
+			pthread_cond_wait(&pipeline->slot_free, &pipeline->lock);
+
+		FileJob* job = &pipeline->jobs[pipeline->submitted % pipeline->window];
+		memset(job, 0, sizeof(FileJob));
+		job->filepath = strdup(filepath);
+		job->rel_path = strdup(rel_path);
+		job->stat_buf = *stat_buf;
+		job->block_index = block;
+		job->block_count = block_count;
+		job->mem_shift = member_mem_shift((uint64_t)stat_buf->st_size, pipeline->level);
+		job->level = pipeline->level;
+		job->algorithm = pipeline->algorithm;
+		job->cipher = pipeline->cipher;
+		job->state = JOB_PENDING;
+		if(!job->filepath || !job->rel_path)
+			printErr("%d: Error: Memory allocation failed for %s\n", __LINE__ - 1, filepath);
+
+		/* Small files are read while the ones before them are coded */
+		if(pipeline->reading && block_count == 1)
+			readahead_submit(&pipeline->ahead, &job->read, job->filepath, (uint64_t)stat_buf->st_size);
+
+		pipeline->submitted++;
+		pthread_cond_signal(&pipeline->work_ready);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
 }
 
-/* Create directory if it doesn't exist */
-int create_directory(const char* path){
-	struct stat st = {0};
-	if(stat(path, &st) == -1)
-		if(mkdir(path, 0755) != 0)
-			printErr("%d: Error: Cannot create directory %s: %s\n", __LINE__ -1,  path, strerror(errno));
-	return 0;
+/* Same size and mtime as the archived member, with previous->hash also the same CRC32C.
+ * Members from builds without checksums or mtimes are always written again */
+int member_unchanged(MemberSet* previous, const Cipher* cipher, const char* filepath, const char* rel_path,
+	const struct stat* stat_buf){
+	PreviousMember* member = members_find(previous, rel_path);
+	if(!member)
+		return 0;
+	member->present = 1;
+	if(!member->has_checksum || member->mtime == 0 || member->original_size != (uint64_t)stat_buf->st_size ||
+		member->mtime != (uint64_t)stat_buf->st_mtime)
+		return 0;
+
+	if(previous->hash){
+		uint64_t clock = stats_clock();
+		MappedFile source;
+		int fd = open(filepath, O_RDONLY);
+		int mapped = (fd >= 0) ? map_range(fd, 0, member->original_size, MAP_READ_FALLBACK, &source) : -1;
+		if(fd >= 0)
+			close(fd);
+		if(mapped != 0)
+			return 0;
+		uint32_t checksum = crc32c(0, source.data, source.size);
+		map_release(&source);
+		stats_time(STAT_HASH, clock);
+		if((checksum ^ cipher_mask_name(cipher, member->filename)) != member->checksum)
+			return 0;
+	}
+
+	member->unchanged = 1;
+	member->permissions = stat_buf->st_mode;
+	return 1;
 }
 
-/* Create parent directories for file path */
-int create_parent_dirs(const char* filepath) {
-	char path[PATH_MAX];
-	strncpy(path, filepath, sizeof(path) - 1);
-	path[sizeof(path) - 1] = '\0';
+/* Single thread: code and write the oldest file of the window. A streamed
+ * one is coded in memory like a worker would, so the size is known before
+ * the header goes out. Files past one block come back deferred and go
+ * through stream_large_file */
+void pipeline_next(Pipeline* pipeline){
+	FileJob* job = &pipeline->jobs[pipeline->written % pipeline->window];
+	if(pipeline->stream){
+		job->state = encode_job(job, NULL);
+		write_job(pipeline, job);
+	} else {
+		uint64_t clock = stats_clock();
+		MappedFile source;
+		int loaded = readahead_wait(&job->read, &source) == 0;
+		stats_time(STAT_READ, clock);
+		process_single_file(job->filepath, job->rel_path, pipeline, &job->stat_buf, loaded ? &source : NULL);
+		free(job->filepath);
+		free(job->rel_path);
+		job->filepath = NULL;
+		job->rel_path = NULL;
+	}
+	pipeline->written++;
+}
 
-	char* slash = strrchr(path, '/');
-	if(slash){
-		*slash = '\0';
-		return create_directory(path);
+/* Wait for every queued file to be written */
+void pipeline_finish(Pipeline* pipeline){
+	if(pipeline->threads <= 1){
+		for(;pipeline->written < pipeline->submitted;)
+			pipeline_next(pipeline);
+	} else {
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->finished = 1;
+		pthread_cond_broadcast(&pipeline->work_ready);
+		pthread_cond_broadcast(&pipeline->job_done);
+		pthread_mutex_unlock(&pipeline->lock);
+
+		for(int i = 0; i < pipeline->threads; i++)
+			pthread_join(pipeline->workers[i], NULL);
+		pthread_join(pipeline->writer, NULL);
 	}
-	return 0;
+	if(pipeline->reading)
+		readahead_stop(&pipeline->ahead);
+
+	pthread_mutex_destroy(&pipeline->lock);
+	pthread_cond_destroy(&pipeline->work_ready);
+	pthread_cond_destroy(&pipeline->job_done);
+	pthread_cond_destroy(&pipeline->slot_free);
+	free(pipeline->jobs);
+	free(pipeline->workers);
 }
 
-/* Add timestamp to file */
-void add_timestamp_to_file(const char* filepath) {
-	/* Update the file's modification time to current time */
-	struct utimbuf new_times;
-	new_times.actime = time(NULL);   /* access time */
-	new_times.modtime = time(NULL);  /* modification time */
-	utime(filepath, &new_times);
+/* Compress queued files in submission order */
+void* pipeline_worker(void* arg){
+	Pipeline* pipeline = arg;
+
+	pthread_mutex_lock(&pipeline->lock);
+	for(;;){
+		for(;pipeline->picked == pipeline->submitted && !pipeline->finished;)
+			pthread_cond_wait(&pipeline->work_ready, &pipeline->lock);
+		if(pipeline->picked == pipeline->submitted)
+			break;
+
+		FileJob* job = &pipeline->jobs[pipeline->picked % pipeline->window];
+		pipeline->picked++;
+		pthread_mutex_unlock(&pipeline->lock);
+
+		int state = encode_job(job, &pipeline->dedup);
+
+		pthread_mutex_lock(&pipeline->lock);
+		job->state = state;
+		pthread_cond_broadcast(&pipeline->job_done);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
 }
 
-/* Check if file should be compressed */
-int should_compress_file(const char* filename) {
-	const char* ext = strrchr(filename, '.');
-	if (!ext) return 1;
+/* Emit finished jobs strictly in submission order */
+void* pipeline_writer(void* arg){
+	Pipeline* pipeline = arg;
+
+	pthread_mutex_lock(&pipeline->lock);
+	for(;;){
+		FileJob* job = &pipeline->jobs[pipeline->written % pipeline->window];
+		for(;(pipeline->written == pipeline->submitted && !pipeline->finished) ||
+			(pipeline->written < pipeline->submitted && job->state == JOB_PENDING);)
+			pthread_cond_wait(&pipeline->job_done, &pipeline->lock);
+		if(pipeline->written == pipeline->submitted)
+			break;
+		pthread_mutex_unlock(&pipeline->lock);
 
-	/* Don't compress already compressed formats */
-	const char* compressed_exts[] = {
-		".zip", ".gz", ".bz2", ".xz", ".7z", ".rar", ".tar",
-		".jpg", ".jpeg", ".png", ".gif", ".bmp", ".tiff",
-		".mp3", ".mp4", ".avi", ".mkv", ".flac", ".wav",
-		".pdf", ".doc", ".docx", ".xls", ".ppt",
-		NULL
-	};
+		write_job(pipeline, job);
 
-	for (int i = 0; compressed_exts[i]; i++) {
-		if (strcasecmp(ext, compressed_exts[i]) == 0) {
-			return 0;
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->written++;
+		pthread_cond_signal(&pipeline->slot_free);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	return NULL;
+}
+
+/* Worker side: build the member payload in memory */
+int encode_job(FileJob* job, DedupTable* dedup){
+	if(job->block_count > 1)
+		return encode_block_job(job, dedup);
+
+	/* Small files are usually in memory already, the rest are mapped here */
+	uint64_t clock = stats_clock();
+	MappedFile source;
+	int state = (readahead_wait(&job->read, &source) == 0) ? JOB_READY : load_job(job, &source);
+	stats_time(STAT_READ, clock);
+	if(state != JOB_READY)
+		return state;
+	uint64_t file_size = source.size;
+
+	/* Content already archived is not coded again, the writer links it */
+	job->file_size = file_size;
+	clock = stats_clock();
+	member_digest(source.data, file_size, BLOCK_SIZE, job->digest);
+	stats_time(STAT_HASH, clock);
+	if(dedup && dedup_find(dedup, DEDUP_FILE, job->digest, NULL)){
+		map_release(&source);
+		job->duplicate = 1;
+		return JOB_READY;
+	}
+
+	/* Same coder as the streaming path, so output matches byte for byte,
+	 * encrypted archives frame what they store too */
+	uint8_t* packed = NULL;
+	size_t packed_len = 0;
+	uint64_t packed_size = 0, raw_size = 0;
+	int compressed = 0;
+	int level = job->level;
+	int framed = level != LEVEL_STORE && data_compressible(source.data, file_size, should_compress_file(job->filepath));
+	if(!framed && job->cipher){
+		level = LEVEL_STORE;
+		framed = 1;
+	}
+	if(framed){
+		FILE* output = open_memstream((char**)&packed, &packed_len);
+		if(output){
+			compressed = compress_buffer(source.data, file_size, output, level, NULL, job->cipher,
+				&packed_size, &raw_size, &job->checksum) == 0;
+			fclose(output);
 		}
 	}
 
-	return 1;
+	if(compressed && (packed_size < file_size || job->cipher) && packed_len == packed_size){
+		job->payload = packed;
+		job->payload_size = packed_size;
+		job->is_compressed = 1;
+		map_release(&source);
+	} else if(job->cipher){
+		free(packed);
+		map_release(&source);
+		return JOB_FAILED;
+	} else {
+		/* Stored members are written from the mapping by the writer */
+		job->checksum = crc32c(0, source.data, file_size);
+		job->source = source;
+		job->payload = NULL;
+		job->payload_size = file_size;
+		job->is_compressed = 0;
+		free(packed);
+	}
+	return JOB_READY;
 }
 
-/* Simple but stable PPM implementation */
-size_t ppm_compress(const uint8_t* input, size_t input_size, uint8_t** output) {
-	if(input_size == 0 || !input || !output){
-		*output = NULL;
-		return 0;
+/* Worker side: map a file that wasn't read ahead. The coder reads the
+ * mapping directly, files that grew past one block are left to the
+ * streaming path */
+int load_job(FileJob* job, MappedFile* source){
+	int fd = open(job->filepath, O_RDONLY);
+	if(fd < 0)
+		return JOB_FAILED;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0){
+		close(fd);
+		return JOB_FAILED;
 	}
-
-	/* Allocate with safe margin */
-	uint8_t* compressed = calloc((input_size + 8), sizeof(uint8_t));
-	if(!compressed){
-		*output = NULL;
-		return 0;
+	if(st.st_size <= 0 || st.st_size > (off_t)BLOCK_SIZE){
+		close(fd);
+		return (st.st_size <= 0) ? JOB_SKIPPED : JOB_DEFERRED;
 	}
 
-	/* Store original size in header */
-	compressed[0] = (input_size >> 24) & 0xFF;
-	compressed[1] = (input_size >> 16) & 0xFF;
-	compressed[2] = (input_size >> 8) & 0xFF;
-	compressed[3] = input_size & 0xFF;
+	int mapped = map_range(fd, 0, (uint64_t)st.st_size, MAP_READ_FALLBACK, source);
+	close(fd);
+	return (mapped == 0) ? JOB_READY : JOB_FAILED;
+}
 
-	/* Simple compression: remove consecutive duplicates */
-	size_t comp_index = 4;
+/* Worker side: one block record of a split file */
+int encode_block_job(FileJob* job, DedupTable* dedup){
+	int fd = open(job->filepath, O_RDONLY);
+	if(fd < 0)
+		return JOB_FAILED;
+
+	/* A file that shrank just yields short or empty blocks,
+	 * the mapping never reaches past the current end */
+	struct stat st;
+	uint64_t offset = job->block_index * BLOCK_SIZE;
+	uint64_t raw = 0;
+	if(fstat(fd, &st) == 0 && (uint64_t)st.st_size > offset)
+		raw = ((uint64_t)st.st_size - offset < BLOCK_SIZE) ? (uint64_t)st.st_size - offset : BLOCK_SIZE;
+
+	uint64_t clock = stats_clock();
+	MappedFile block;
+	uint8_t* record = malloc(record_bound(job->level, BLOCK_SIZE));
+	int mapped = record ? map_range(fd, offset, raw, MAP_READ_FALLBACK, &block) : -1;
+	close(fd);
+	stats_time(STAT_READ, clock);
+
+	if(mapped != 0){
+		free(record);
+		return JOB_FAILED;
+	}
 
-	for(size_t i = 0;i < input_size;){
-		uint8_t current = input[i];
-		size_t count = 1;
+	/* Blocks seen before become references, the coder is skipped */
+	job->file_size = raw;
+	job->is_compressed = 1;
+	job->duplicate = 0;
+	clock = stats_clock();
+	job->checksum = raw ? crc32c(0, block.data, (size_t)raw) : 0;
+	if(raw)
+		sha256(block.data, (size_t)raw, job->digest);
+	stats_time(STAT_HASH, clock);
+	if(raw && dedup && dedup_find(dedup, DEDUP_BLOCK, job->digest, NULL)){
+		free(record);
+		job->duplicate = 1;
+	} else {
+		job->payload_size = raw ? encode_block(block.data, (size_t)raw, job->level, job->mem_shift,
+			job->checksum, job->cipher, record) : 0;
+		job->payload = record;
+	}
+	map_release(&block);
+	return JOB_READY;
+}
 
-		/* Count consecutive identical bytes */
-		for(;i + count < input_size && input[i + count] == current && count < 255; count++);
+/* Writer side: header and payload at the running offset */
+void write_job(Pipeline* pipeline, FileJob* job){
+	/* The copy a worker matched is gone, code the file here after all */
+	DedupEntry target;
+	int linked = job->block_count <= 1 && job->state == JOB_READY && !pipeline->stream &&
+		dedup_find(&pipeline->dedup, DEDUP_FILE, job->digest, &target);
+	if(job->block_count <= 1 && job->state == JOB_READY && job->duplicate && !linked)
+		job->state = encode_job(job, NULL);
+
+	if(job->block_count > 1)
+		write_block_job(pipeline, job);
+	else if(job->state == JOB_DEFERRED)
+		/* Too large to hold, stream it through the serial path */
+		process_single_file(job->filepath, job->rel_path, pipeline, &job->stat_buf, NULL);
+	else if(job->state == JOB_SKIPPED)
+		fprintf(stdout, "Skipped: %s (empty file)\n", job->rel_path);
+	else if(job->state == JOB_FAILED)
+		fprintf(stderr, "%d: Error: Cannot read file %s\n", __LINE__ - 1, job->filepath);
+	else if(linked)
+		write_link(pipeline, job->rel_path, &job->stat_buf, &target);
+	else {
+		FileHeader header;
+		memset(&header, 0, sizeof(FileHeader));
+
+		strncpy(header.filename, job->rel_path, sizeof(header.filename) - 1);
+		header.permissions = job->stat_buf.st_mode;
+		header.offset = *pipeline->total_size;
+		header.algorithm = job->algorithm;
+		header.file_size = job->payload_size;
+		header.is_compressed = job->is_compressed;
+
+		const char* coder = member_coder(job->is_compressed, job->algorithm, job->file_size, job->payload_size);
+		if(pipeline->vflag == 1){
+			if(job->is_compressed)
+				fprintf(stdout, "Processed: %s (%s) %lu -> %lu bytes\n", job->rel_path, coder ? coder : "store",
+					(unsigned long)job->file_size, (unsigned long)job->payload_size);
+			else
+				fprintf(stdout, "Processed: %s (store) %lu bytes\n", job->rel_path, (unsigned long)job->file_size);
+		}
 
-		if(count > 3){
-			/* Encode run */
-			compressed[comp_index++] = current;
-			compressed[comp_index++] = current; /* Marker */
-			compressed[comp_index++] = (uint8_t)count;
-			i += count;
+		uint64_t clock = stats_clock();
+		const uint8_t* payload = job->payload ? job->payload : job->source.data;
+		if(member_header_write(pipeline->archive, pipeline->format, &header) != 0 ||
+			fwrite(payload, 1, job->payload_size, pipeline->archive) != job->payload_size ||
+			stream_trailer(pipeline, header.filename, job->checksum) != 0){
+			fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__ - 2, job->rel_path, strerror(errno));
+			stats_count(STAT_FAILED, 1);
 		} else
-			/* Copy literal */
-			for(size_t j = 0; j < count; j++)
-				compressed[comp_index++] = input[i++];
+			record_member(pipeline, &header, job->file_size, job->checksum, &job->stat_buf, job->digest);
+		stats_time(STAT_WRITE, clock);
 	}
-    
-	/* Check if compression actually helped */
-	if (comp_index >= input_size) {
-		/* Compression didn't help - store original */
-		free(compressed);
-		*output = NULL;
-		return 0;
+	if(job->state == JOB_SKIPPED || job->state == JOB_FAILED)
+		stats_count(job->state == JOB_SKIPPED ? STAT_SKIPPED : STAT_FAILED, 1);
+
+	free(job->payload);
+	map_release(&job->source);
+	free(job->filepath);
+	free(job->rel_path);
+	job->payload = NULL;
+	job->filepath = NULL;
+	job->rel_path = NULL;
+}
+
+/* Writer side: assemble a split file, header goes in after the last block */
+void write_block_job(Pipeline* pipeline, FileJob* job){
+	BlockFrame* frame = &pipeline->frame;
+
+	if(job->block_index == 0){
+		pipeline->member_pos = (off_t)*pipeline->total_size;
+		off_t payload_pos = pipeline->member_pos + (off_t)member_header_size(pipeline->format, job->rel_path);
+		if(pipeline->stream ? stream_header(pipeline, job->rel_path, &job->stat_buf, 1, STREAM_SIZE_UNKNOWN) != 0 :
+			fseeko(pipeline->archive, payload_pos, SEEK_SET) != 0){
+			memset(frame, 0, sizeof(BlockFrame));
+			frame->status = -1;
+		} else {
+			int order;
+			codec_level(job->level, &order);
+			frame_begin(frame, pipeline->archive, order, job->mem_shift, pipeline->cipher);
+		}
+		frame->dedup = pipeline->stream ? NULL : &pipeline->dedup;
+		pipeline->dedup_mark = dedup_mark(&pipeline->dedup);
+		member_digest_init(&pipeline->member_hash, (uint64_t)job->stat_buf.st_size);
 	}
 
-	*output = compressed;
-	return comp_index;
+	/* Repeated blocks go in as references, a block the worker skipped
+	 * whose copy was rolled back is coded here */
+	if(job->state != JOB_READY){
+		fprintf(stderr, "%d: Error: Cannot read file %s\n", __LINE__ - 1, job->filepath);
+		frame->status = -1;
+	} else if(job->file_size && frame->status == 0){
+		sha256_update(&pipeline->member_hash, job->digest, SHA256_SIZE);
+		if(!frame_reference(frame, job->digest, (uint32_t)job->file_size, job->checksum)){
+			if(job->duplicate && encode_block_job(job, NULL) != JOB_READY)
+				frame->status = -1;
+			else
+				frame_block(frame, job->payload, job->payload_size, job->digest, job->checksum);
+		}
+	}
+
+	if(job->block_index + 1 < job->block_count)
+		return;
+
+	frame_end(frame);
+
+	/* The whole file repeats an earlier member, replace it with a link */
+	uint8_t digest[SHA256_SIZE];
+	DedupEntry target;
+	sha256_final(&pipeline->member_hash, digest);
+	if(frame->status == 0 && !pipeline->stream && dedup_find(&pipeline->dedup, DEDUP_FILE, digest, &target)){
+		dedup_rollback(&pipeline->dedup, pipeline->dedup_mark);
+		write_link(pipeline, job->rel_path, &job->stat_buf, &target);
+		return;
+	}
+
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
+
+	strncpy(header.filename, job->rel_path, sizeof(header.filename) - 1);
+	header.permissions = job->stat_buf.st_mode;
+	header.offset = (uint64_t)pipeline->member_pos;
+	header.algorithm = job->algorithm;
+	header.file_size = frame->size;
+	header.is_compressed = 1;
+
+	/* Nothing in a stream can be taken back, a half written member ends it */
+	if(pipeline->stream && (frame->status != 0 || stream_trailer(pipeline, header.filename, frame->checksum) != 0))
+		printErr("%d: Error: Write failed for %s, the archive stream is cut short\n", __LINE__ - 1, job->rel_path);
+
+	off_t member_end = pipeline->member_pos +
+		(off_t)(member_header_size(pipeline->format, header.filename) + frame->size);
+	if(!pipeline->stream && (frame->status != 0 || fseeko(pipeline->archive, pipeline->member_pos, SEEK_SET) != 0 ||
+		member_header_write(pipeline->archive, pipeline->format, &header) != 0 ||
+		fseeko(pipeline->archive, member_end, SEEK_SET) != 0)){
+		fprintf(stderr, "%d: Error: Write failed for %s: %s\n", __LINE__ - 3, job->rel_path, strerror(errno));
+		dedup_rollback(&pipeline->dedup, pipeline->dedup_mark);
+		fseeko(pipeline->archive, pipeline->member_pos, SEEK_SET);
+		return;
+	}
+
+	record_member(pipeline, &header, frame->total_raw, frame->checksum, &job->stat_buf, digest);
+	const char* coder = member_coder(1, job->algorithm, frame->total_raw, frame->size);
+	if(pipeline->vflag == 1)
+		fprintf(stdout, "Processed: %s (%s) %lu -> %lu bytes\n", job->rel_path, coder ? coder : "store",
+			(unsigned long)frame->total_raw, (unsigned long)frame->size);
+}
+
+/* Archive on stdout, the messages that used to go there move to stderr */
+FILE* stream_stdout(void){
+	if(isatty(STDOUT_FILENO))
+		printErr("%d: Error: Refusing to write an archive to a terminal\n", __LINE__ - 1);
+	fflush(stdout);
+	int fd = dup(STDOUT_FILENO);
+	FILE* archive = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+	if(!archive || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		return NULL;
+	return archive;
+}
+
+/* Member header of a streamed archive, written once before the payload */
+int stream_header(Pipeline* pipeline, const char* rel_path, const struct stat* stat_buf, uint8_t is_compressed,
+	uint64_t size){
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
+	strncpy(header.filename, rel_path, sizeof(header.filename) - 1);
+	header.permissions = stat_buf->st_mode;
+	header.offset = *pipeline->total_size;
+	header.algorithm = pipeline->algorithm;
+	header.is_compressed = is_compressed;
+	header.file_size = size;
+	return member_header_write(pipeline->archive, pipeline->format, &header);
 }
 
-size_t ppm_decompress(const uint8_t* input, size_t input_size, uint8_t** output) {
-	if (input_size < 4 || !input || !output) {
-		*output = NULL;
+/* CRC32C after a streamed payload, a reader checks the member before the directory arrives.
+ * Masked like the directory entry in a password archive */
+int stream_trailer(Pipeline* pipeline, const char* filename, uint32_t checksum){
+	if(!pipeline->stream)
 		return 0;
+	uint8_t raw[STREAM_CRC_SIZE];
+	put_le32(raw, checksum ^ cipher_mask_name(pipeline->cipher, filename));
+	return (fwrite(raw, 1, STREAM_CRC_SIZE, pipeline->archive) == STREAM_CRC_SIZE) ? 0 : -1;
+}
+
+/* A file too large to hold goes out framed behind a header without a size,
+ * or stored when it won't compress. Its mapping is the only buffer */
+void stream_large_file(const char* filepath, const char* rel_path, Pipeline* pipeline,
+	const struct stat* stat_buf){
+	int fd = open(filepath, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0){
+		fprintf(stderr, "%d: Warning: Cannot open file %s: %s\n", __LINE__ - 2, filepath, strerror(errno));
+		if(fd >= 0)
+			close(fd);
+		stats_count(STAT_FAILED, 1);
+		return;
 	}
-    
-	/* Read original size from header */
-	size_t original_size = (input[0] << 24) | (input[1] << 16) | (input[2] << 8) | input[3];
 
-	if (original_size == 0) {
-		*output = NULL;
-		return 0;
+	uint64_t clock = stats_clock();
+	MappedFile source;
+	int mapped = (st.st_size > 0) ? map_range(fd, 0, (uint64_t)st.st_size, MAP_READ_FALLBACK, &source) : -1;
+	close(fd);
+	stats_time(STAT_READ, clock);
+	if(st.st_size <= 0){
+		fprintf(stdout, "Skipped: %s (empty file)\n", rel_path);
+		stats_count(STAT_SKIPPED, 1);
+		return;
+	}
+	if(mapped != 0){
+		fprintf(stderr, "%d: Error: Cannot read file %s\n", __LINE__ - 1, filepath);
+		stats_count(STAT_FAILED, 1);
+		return;
 	}
 
-	uint8_t* decompressed = malloc(original_size);
-	if (!decompressed) {
-		*output = NULL;
-		return 0;
+	/* Same choice as the parallel path, whose blocks give the same frame,
+	 * encrypted archives frame what they store too */
+	FileHeader header;
+	memset(&header, 0, sizeof(FileHeader));
+	strncpy(header.filename, rel_path, sizeof(header.filename) - 1);
+	header.permissions = stat_buf->st_mode;
+	header.offset = *pipeline->total_size;
+	header.algorithm = pipeline->algorithm;
+	int level = pipeline->level;
+	header.is_compressed = level != LEVEL_STORE && (source.size > BLOCK_SIZE ||
+		data_compressible(source.data, source.size, should_compress_file(filepath)));
+	if(!header.is_compressed && pipeline->cipher){
+		level = LEVEL_STORE;
+		header.is_compressed = 1;
 	}
 
-	size_t decomp_index = 0;
-	size_t comp_index = 4;
+	uint64_t original_size = source.size;
+	uint32_t checksum = 0;
+	int status = stream_header(pipeline, rel_path, stat_buf, header.is_compressed,
+		header.is_compressed ? STREAM_SIZE_UNKNOWN : source.size);
+	if(status == 0 && header.is_compressed)
+		status = compress_buffer(source.data, source.size, pipeline->archive, level, NULL, pipeline->cipher,
+			&header.file_size, &original_size, &checksum);
+	else if(status == 0){
+		clock = stats_clock();
+		checksum = crc32c(0, source.data, source.size);
+		status = (fwrite(source.data, 1, source.size, pipeline->archive) == source.size) ? 0 : -1;
+		header.file_size = source.size;
+		stats_time(STAT_WRITE, clock);
+	}
+	map_release(&source);
 
-	for(;comp_index < input_size && decomp_index < original_size;){
-		if (comp_index + 2 < input_size && input[comp_index] == input[comp_index + 1]) {
-			/* Decode run */
-			uint8_t value = input[comp_index];
-			uint8_t count = input[comp_index + 2];
+	/* Nothing in a stream can be taken back, a half written member ends it */
+	if(status != 0 || stream_trailer(pipeline, header.filename, checksum) != 0)
+		printErr("%d: Error: Write failed for %s, the archive stream is cut short\n", __LINE__ - 1, rel_path);
 
-			for (uint8_t j = 0; j < count && decomp_index < original_size; j++)
-				decompressed[decomp_index++] = value;
-			comp_index += 3;
-		} else
-			/* Copy literal */
-			decompressed[decomp_index++] = input[comp_index++];
+	record_member(pipeline, &header, original_size, checksum, stat_buf, NULL);
+	const char* coder = member_coder(header.is_compressed, header.algorithm, original_size, header.file_size);
+	if(pipeline->vflag == 1)
+		fprintf(stdout, "Processed: %s (%s) %lu -> %lu bytes\n", rel_path, coder ? coder : "store",
+			(unsigned long)original_size, (unsigned long)header.file_size);
+}
+
+/* Add timestamp to file */
+void add_timestamp_to_file(const char* filepath) {
+	/* Update the file's modification time to current time */
+	struct utimbuf new_times;
+	new_times.actime = time(NULL);   /* access time */
+	new_times.modtime = time(NULL);  /* modification time */
+	utime(filepath, &new_times);
+}
+
+/* Extension hint for the entropy estimate, 0 for known packed formats */
+int should_compress_file(const char* filename) {
+	const char* ext = strrchr(filename, '.');
+	if (!ext) return 1;
+
+	/* Don't compress already compressed formats */
+	const char* compressed_exts[] = {
+		".zip", ".gz", ".bz2", ".xz", ".7z", ".rar", ".tar",
+		".jpg", ".jpeg", ".png", ".gif", ".bmp", ".tiff",
+		".mp3", ".mp4", ".avi", ".mkv", ".flac", ".wav",
+		".pdf", ".doc", ".docx", ".xls", ".ppt",
+		".jar", ".zst", ".lz4", ".webp", ".webm", ".ogg", ".opus",
+		NULL
+	};
+
+	for (int i = 0; compressed_exts[i]; i++) {
+		if (strcasecmp(ext, compressed_exts[i]) == 0) {
+			return 0;
+		}
 	}
 
-	*output = decompressed;
-	return decomp_index;
+	return 1;
 }
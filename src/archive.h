@@ -8,22 +8,61 @@
 #include <string.h>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <utime.h>
 #include <time.h>
+#include <fnmatch.h>
+
+#include <pthread.h>
 
 #include <sys/stat.h>
 
 #include "lib.h"
+#include "codec.h"
+#include "walk.h"
+#include "dircache.h"
+#include "readahead.h"
 
 /* defines */
-#define MAGIC "HxKl1488" 
-#define ALGO_PPM 1
+#define MAGIC "HxKl1488"          /* legacy archives, raw struct headers */
+#define MAGIC_PACKED "HxKlPak2"   /* packed little-endian headers, see format.c */
+#define FORMAT_LEGACY 1
+#define FORMAT_PACKED 2
+#define ARCHIVE_HEADER_SIZE 32    /* both formats */
+#define CIPHER_HEADER_SIZE 32     /* after the header of a packed password archive */
+#define MEMBER_HEADER_FIXED 14    /* packed member header without the name */
+#define ARCHIVE_FLAG_PASSWORD 1
+#define ARCHIVE_FLAG_STREAM 2     /* written front to back to a pipe, see format.c */
+#define STREAM_PATH "-"           /* archive name for stdout on create, stdin on extract */
+#define STREAM_SIZE_UNKNOWN UINT64_MAX    /* header size of a streamed frame, it ends by itself */
+#define STREAM_CRC_SIZE 4         /* CRC32C after every streamed payload */
+#define STREAM_END 0xFF           /* in place of a member header after the last member */
+#define INDEX_MAGIC "HxKlIdx1"
+#define INDEX_VERSION 3           /* 1 has no member checksums, 3 is varints and front-coded names */
+#define INDEX_VERSION_FIXED 2     /* fixed entries, kept in legacy archives for older builds */
+#define INDEX_ENTRY_SIZE 44       /* version 2 directory entry without the name */
+#define INDEX_ENTRY_SIZE_V1 40
+#define INDEX_FOOTER_SIZE 32      /* magic, version, reserved, offset, count */
+#define INDEX_ENTRY_MAX (BUFFER*2 + 128)  /* longest directory entry of any version */
+#define INDEX_WINDOW (1 << 18)    /* directory bytes a reader holds */
+#define INDEX_SPILL (1 << 20)     /* directory bytes a writer holds before using a temporary file */
+#define JOBS_PER_THREAD 4         /* files or blocks in flight per worker */
+#define OUTPUT_MAP_MIN (1UL << 20)    /* extracted members from this size are decoded into a mapping */
+#define UPDATE_DEAD_SHARE 4       /* u rebuilds an archive once this share of it holds no member */
+#define UPDATE_SUFFIX ".update"   /* rebuilt archive next to the old one until it is renamed over it */
+
+/* Job states */
+#define JOB_PENDING 0
+#define JOB_READY 1
+#define JOB_SKIPPED 2
+#define JOB_DEFERRED 3
+#define JOB_FAILED 4
 
 #define SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 
-/* File header structure */
+/* File header structure, on disk as is in legacy archives */
 typedef struct {
 	char filename[BUFFER*2];       /* original file name */
 	uint64_t file_size;       /* file size in bytes */
@@ -33,33 +72,206 @@ typedef struct {
 	uint8_t algorithm;        /* compression algorithm */
 } FileHeader;
 
-/* PPM context structure */
-typedef struct PPMNode {
-	uint8_t symbol;
-	uint32_t count;
-	struct PPMNode* next;
-} PPMNode;
-
-/* PPM model structure */
-typedef struct {
-	PPMNode** contexts;
-	int order;
-	size_t memory_limit;
-} PPMModel;
-
 /* Archive header structure */
 typedef struct {
 	char magic[8];            /* magic number*/
-	uint16_t file_count;      /* number of files */
+	uint64_t file_count;      /* number of files, 16 bits in legacy archives */
 	uint64_t total_size;      /* total archive size */
 	uint8_t has_password;     /* password protection flag */
+	uint8_t format;           /* FORMAT_*, from the magic */
+	uint8_t streamed;         /* ARCHIVE_FLAG_STREAM, never patched after the members */
+	uint8_t salt[CIPHER_SALT_SIZE];   /* key derivation of a password archive */
+	uint32_t iterations;
+	uint8_t check[CIPHER_CHECK_SIZE];
 } ArchiveHeader;
 
+/* Member as described by the central directory */
+typedef struct {
+	char filename[BUFFER*2];
+	uint64_t offset;          /* position of the member's FileHeader */
+	uint64_t file_size;       /* payload size in archive */
+	uint64_t original_size;   /* size once extracted */
+	uint64_t mtime;           /* source modification time, 0 if unknown */
+	uint32_t permissions;
+	uint8_t is_compressed;
+	uint8_t algorithm;
+	uint32_t checksum;        /* CRC32C of the extracted bytes */
+	int has_checksum;         /* 0 for archives from older builds */
+} ArchiveEntry;
+
+/* Central directory collected while writing */
+typedef struct {
+	uint8_t* data;            /* packed entries not spilled yet */
+	size_t size;
+	size_t capacity;
+	uint64_t count;
+	FILE* spill;              /* earlier entries, NULL until INDEX_SPILL is reached */
+	uint64_t spilled;
+	uint32_t version;         /* INDEX_VERSION or INDEX_VERSION_FIXED */
+	char last[BUFFER*2];      /* previous name, the next one is coded against it */
+} IndexWriter;
+
+/* Member listing from the directory, or from the headers of old archives */
+typedef struct {
+	FILE* file;
+	ArchiveHeader header;
+	uint64_t archive_size;
+	uint64_t data_end;        /* members live below this offset */
+	uint64_t count;
+	uint64_t position;
+	off_t next;               /* next member header when walking */
+	uint64_t directory;       /* archive offset of the central directory */
+	uint64_t directory_size;
+	uint64_t cursor;          /* parse position in the directory */
+	uint8_t* window;          /* directory bytes from window_start, read as parsing goes */
+	uint64_t window_start;
+	size_t window_length;
+	size_t entry_size;        /* fixed part of a version 1 or 2 directory entry */
+	uint32_t version;         /* INDEX_VERSION of the directory */
+	char last[BUFFER*2];      /* previous name of a front-coded directory */
+	size_t last_length;
+	int has_index;
+} IndexReader;
+
+/* Member of the archive being updated */
+typedef struct {
+	char* filename;
+	uint64_t offset;
+	uint64_t file_size;
+	uint64_t original_size;
+	uint64_t mtime;
+	uint32_t permissions;
+	uint32_t checksum;
+	uint8_t is_compressed;
+	uint8_t algorithm;
+	int has_checksum;
+	int present;              /* the file is still in the tree */
+	int unchanged;            /* and matches, the member is kept as is */
+} PreviousMember;
+
+/* Members of the archive being updated, sorted by name */
+typedef struct {
+	PreviousMember* members;
+	uint64_t count;
+	int hash;                 /* also compare contents against the member checksum */
+} MemberSet;
+
+/* Archive check shared by the verify threads */
+typedef struct {
+	const char* archive_path;
+	IndexReader reader;       /* members handed out under the lock */
+	const Cipher* cipher;     /* key of a password archive, NULL otherwise */
+	int threads;
+	uint64_t valid;
+	int damaged;              /* the index itself could not be read */
+	pthread_mutex_t lock;
+	pthread_mutex_t split_lock;   /* one split member decodes at a time */
+} Verifier;
+
+/* Extraction shared by the decode threads */
+typedef struct {
+	const char* archive_path;
+	const char* output_dir;
+	IndexReader reader;       /* members handed out under the lock */
+	const Cipher* cipher;     /* key of a password archive, NULL otherwise */
+	int threads;
+	int vflag;
+	char* const* members;     /* selection from the command line */
+	int member_count;
+	uint8_t* matched;
+	uint64_t selected;
+	uint64_t extracted;
+	int damaged;              /* the index itself could not be read */
+	DirCache dirs;
+	pthread_mutex_t lock;
+	pthread_mutex_t split_lock;   /* one split member decodes at a time */
+} Extractor;
+
+/* File queued for compression */
+typedef struct {
+	char* filepath;
+	char* rel_path;
+	struct stat stat_buf;
+	uint8_t* payload;         /* member payload once ready */
+	uint64_t payload_size;
+	MappedFile source;        /* stored file, written from the mapping */
+	ReadRequest read;         /* small file read ahead of its turn */
+	uint8_t digest[SHA256_SIZE];  /* member digest, or block digest of a split file */
+	int duplicate;            /* content was archived already, nothing coded */
+	uint64_t file_size;       /* original size */
+	uint32_t checksum;        /* CRC32C of the file, or of the block */
+	uint64_t block_index;     /* block of a split file */
+	uint64_t block_count;     /* 1 unless the file is split */
+	int mem_shift;            /* model size shared by all blocks of a file */
+	int level;                /* LEVEL_*, see codec_level */
+	uint8_t algorithm;        /* FileHeader.algorithm of the level */
+	uint8_t is_compressed;
+	Cipher* cipher;           /* key of a password archive, NULL otherwise */
+	int state;                /* JOB_* */
+} FileJob;
+
+/* Ordered create pipeline: walker submits, workers compress, writer emits.
+ * A single thread codes the oldest file itself once the window is full */
+typedef struct {
+	FILE* archive;
+	uint64_t* file_count;
+	uint64_t* total_size;
+	int vflag;
+	int threads;
+	int format;               /* FORMAT_* of the member headers */
+	int stream;               /* archive is a pipe, nothing is written twice */
+	int level;                /* compression level of the run */
+	uint8_t algorithm;        /* FileHeader.algorithm of the level */
+	Cipher* cipher;           /* key of a password archive, every record is sealed */
+	FileJob* jobs;            /* ring of window slots indexed by sequence */
+	ReadAhead ahead;
+	int reading;              /* ahead is running, small files are read before their turn */
+	size_t window;
+	uint64_t submitted;
+	uint64_t picked;
+	uint64_t written;
+	int finished;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t job_done;
+	pthread_cond_t slot_free;
+	pthread_t writer;
+	pthread_t* workers;
+	BlockFrame frame;         /* member being assembled from block jobs */
+	off_t member_pos;
+	Sha256 member_hash;       /* block digests of the member being assembled */
+	uint64_t dedup_mark;      /* table size when the member started */
+	DedupTable dedup;
+	IndexWriter index;
+	MemberSet* previous;      /* archive being updated, NULL on create */
+} Pipeline;
+
 /* Function declarations */
 long getFileSize(FILE *archive);
-int create_archive(const char* dir_path, const char* archive_path, const char* password, int vflag);
-int extract_archive(const char* archive_path, const char* output_dir, const char* password, int vflag);
+int create_archive(const char* dir_path, const char* archive_path, const char* password, int vflag, int threads,
+	int level);
+int update_archive(const char* dir_path, const char* archive_path, const char* password, int vflag, int threads,
+	int level, int hash);
+int extract_archive(const char* archive_path, const char* output_dir, const char* password, int vflag, int threads,
+	char* const* members, int member_count);
 void list_archive_contents(const char* archive_path);
-int verify_archive(const char* archive_path);
+int verify_archive(const char* archive_path, const char* password, int threads);
+int archive_header_read(FILE* archive, ArchiveHeader* header);
+int archive_header_write(FILE* archive, const ArchiveHeader* header);
+uint64_t archive_header_size(const ArchiveHeader* header);
+int archive_key(const ArchiveHeader* header, const char* password, Cipher* cipher);
+size_t member_header_size(int format, const char* filename);
+int member_header_write(FILE* archive, int format, const FileHeader* header);
+size_t member_header_read(FILE* archive, int format, off_t offset, FileHeader* header);
+size_t member_header_next(FILE* archive, int format, FileHeader* header);
+int index_add(IndexWriter* writer, const FileHeader* header, uint64_t original_size, uint64_t mtime, uint32_t checksum);
+int index_write(IndexWriter* writer, FILE* archive, uint64_t offset, uint64_t* written);
+void index_free(IndexWriter* writer);
+int index_open(const char* archive_path, IndexReader* reader);
+int index_next(IndexReader* reader, ArchiveEntry* entry);
+void index_close(IndexReader* reader);
+int members_load(IndexReader* reader, MemberSet* set);
+PreviousMember* members_find(MemberSet* set, const char* filename);
+void members_free(MemberSet* set);
 
 #endif
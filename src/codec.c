@@ -0,0 +1,787 @@
+#include "codec.h"
+
+static int decode_block(const uint8_t* packed, uint32_t length, uint8_t* output, uint32_t raw, int order, int mem_shift);
+static int decode_record(int fd, const uint8_t* header, size_t header_size, const uint8_t* data, uint8_t* output,
+	int order, int mem_shift, const Cipher* cipher, uint8_t* scratch, uint32_t* expected);
+static int decode_checked(int fd, const uint8_t* header, size_t header_size, const uint8_t* data, uint8_t* output,
+	int order, int mem_shift, const Cipher* cipher, uint8_t* scratch, uint32_t* crc);
+static int open_record(const Cipher* cipher, const uint8_t* header, const uint8_t* data, uint8_t* output,
+	uint32_t length);
+static int emit(const uint8_t* data, size_t length, FILE* output);
+static uint8_t* sink_target(const MemberSink* sink, size_t length);
+static int sink_emit(MemberSink* sink, const uint8_t* data, size_t length);
+static uint32_t record_size(uint32_t length, size_t overhead);
+static void* block_worker(void* arg);
+static int member_read(const MappedFile* map, int fd, off_t start, uint64_t at, uint8_t* dst, size_t length);
+static size_t rle_decompress(const uint8_t* input, size_t input_size, uint8_t** output);
+
+/* Scale the model to one block, tiny files don't need a large table.
+ * Levels past LEVEL_ORDER_TOP double it, a longer context only dilutes
+ * the statistics of a block while fewer resets keep helping */
+int member_mem_shift(uint64_t size_hint, int level){
+	if(size_hint > BLOCK_SIZE)
+		size_hint = BLOCK_SIZE;
+	int extra = (level > LEVEL_ORDER_TOP) ? level - LEVEL_ORDER_TOP : 0;
+
+	int mem_shift = 16;
+	for(;((uint64_t)1 << mem_shift) < (size_hint * 16) << extra &&
+		((uint64_t)1 << mem_shift) < PPM_DEFAULT_MEMORY << extra; mem_shift++);
+	return mem_shift;
+}
+
+/* One independent block as a {raw, packed, crc, data} record, sealed
+ * when there is a cipher. record must hold record_bound(level, raw) bytes.
+ * The level names the coder, a sample of the block can overrule it */
+size_t encode_block(const uint8_t* input, size_t raw, int level, int mem_shift, uint32_t crc, Cipher* cipher,
+	uint8_t* record){
+	int order;
+	uint8_t* data = record + BLOCK_HEADER_SIZE + (cipher ? CIPHER_NONCE_SIZE : 0);
+	uint64_t clock = stats_clock();
+	const Codec* codec = codec_level(level, &order);
+	int verdict = codec ? block_class(input, raw) : BLOCK_CLASS_STORE;
+	if(verdict == BLOCK_CLASS_STORE)
+		codec = NULL;
+	else if(verdict == BLOCK_CLASS_RUNS)
+		codec = codec_find(ALGO_FAST);
+	size_t coded = codec ? codec->compress(input, raw, order, mem_shift, data, codec->bound(raw)) : 0;
+	stats_time(STAT_COMPRESS, clock);
+
+	/* Block didn't shrink, store it raw */
+	uint32_t packed = (uint32_t)coded | (codec ? (uint32_t)codec->block_tag << BLOCK_CODEC_SHIFT : 0);
+	if(coded == 0 || coded >= raw){
+		memcpy(data, input, raw);
+		coded = raw;
+		packed = (uint32_t)raw;
+	}
+	if(packed == raw)
+		stats_count(STAT_BLOCKS_STORED, 1);
+	else if(codec->algorithm == ALGO_FAST && level != LEVEL_FAST)
+		stats_count(STAT_BLOCKS_RUNS, 1);
+
+	put_le32(record, (uint32_t)raw);
+	put_le32(record + 4, packed);
+	put_le32(record + 8, crc);
+	if(!cipher)
+		return BLOCK_HEADER_SIZE + coded;
+
+	/* The nonce goes first, the header it masks the crc in is sealed along */
+	uint8_t* nonce = record + BLOCK_HEADER_SIZE;
+	clock = stats_clock();
+	cipher_nonce(cipher, nonce);
+	put_le32(record + 8, crc ^ cipher_mask(cipher, nonce));
+	cipher_seal(cipher, nonce, record, BLOCK_HEADER_SIZE, data, coded, data + coded);
+	stats_time(STAT_CIPHER, clock);
+	return BLOCK_HEADER_SIZE + coded + CIPHER_OVERHEAD;
+}
+
+/* Decode one record body, packed == raw means stored */
+int decode_block(const uint8_t* packed, uint32_t length, uint8_t* output, uint32_t raw, int order, int mem_shift){
+	if(length == raw){
+		memcpy(output, packed, raw);
+		return 0;
+	}
+
+	const Codec* codec = codec_block(length >> BLOCK_CODEC_SHIFT);
+	if(!codec)
+		return -1;
+	return codec->decompress(packed, length & BLOCK_LENGTH_MASK, output, raw, order, mem_shift);
+}
+
+/* Bytes of record data that follow a {raw, packed, crc} header,
+ * overhead is what the cipher adds to records holding data */
+uint32_t record_size(uint32_t length, size_t overhead){
+	return (length == BLOCK_REF) ? BLOCK_REF_SIZE : (length & BLOCK_LENGTH_MASK) + (uint32_t)overhead;
+}
+
+/* Decode a record body, following a reference to the earlier copy.
+ * expected is the crc the record was written with, unmasked */
+int decode_record(int fd, const uint8_t* header, size_t header_size, const uint8_t* data, uint8_t* output,
+	int order, int mem_shift, const Cipher* cipher, uint8_t* scratch, uint32_t* expected){
+	uint32_t raw = get_le32(header);
+	uint32_t length = get_le32(header + 4);
+	*expected = (header_size == BLOCK_HEADER_SIZE) ? get_le32(header + 8) : 0;
+	if(length != BLOCK_REF && !cipher)
+		return decode_block(data, length, output, raw, order, mem_shift);
+
+	/* Stored data opens straight into place, coded data into scratch */
+	if(length != BLOCK_REF){
+		uint8_t* plain = (length == raw) ? output : scratch;
+		if(open_record(cipher, header, data, plain, length & BLOCK_LENGTH_MASK) != 0)
+			return -1;
+		*expected ^= cipher_mask(cipher, data);
+		return (plain == output) ? 0 : decode_block(plain, length, output, raw, order, mem_shift);
+	}
+
+	uint8_t target_header[BLOCK_HEADER_SIZE];
+	off_t target = (off_t)get_le64(data);
+	if(pread(fd, target_header, header_size, target) != (ssize_t)header_size || get_le32(target_header) != raw)
+		return -1;
+
+	/* References always point at a record that holds data, a sealed
+	 * one opens in place and its crc stands in for the reference's */
+	size_t overhead = cipher ? CIPHER_OVERHEAD : 0;
+	uint32_t target_length = get_le32(target_header + 4);
+	uint32_t size = record_size(target_length, overhead);
+	uint8_t* packed = (target_length != BLOCK_REF && size <= raw + overhead) ? malloc(size ? size : 1) : NULL;
+	uint32_t target_crc = 0;
+	int status = -1;
+	if(packed && pread(fd, packed, size, target + (off_t)header_size) == (ssize_t)size &&
+		data[8] <= PPM_MAX_ORDER && data[9] <= 40)
+		status = decode_record(fd, target_header, header_size, packed, output, data[8], data[9], cipher,
+			cipher ? packed + CIPHER_NONCE_SIZE : NULL, &target_crc);
+	free(packed);
+	if(cipher)
+		*expected = target_crc;
+	return status;
+}
+
+/* Open the sealed data of a record, wiped output when it was tampered with */
+int open_record(const Cipher* cipher, const uint8_t* header, const uint8_t* data, uint8_t* output,
+	uint32_t length){
+	return cipher_open(cipher, data, header, BLOCK_HEADER_SIZE, data + CIPHER_NONCE_SIZE, output, length,
+		data + CIPHER_NONCE_SIZE + length);
+}
+
+/* Decode one record and check it against the CRC it was written with */
+int decode_checked(int fd, const uint8_t* header, size_t header_size, const uint8_t* data, uint8_t* output,
+	int order, int mem_shift, const Cipher* cipher, uint8_t* scratch, uint32_t* crc){
+	uint32_t raw = get_le32(header), expected = 0;
+	uint64_t clock = stats_clock();
+	int status = decode_record(fd, header, header_size, data, output, order, mem_shift, cipher, scratch, &expected);
+	stats_time(STAT_DECODE, clock);
+	if(status != 0)
+		return -1;
+
+	*crc = crc32c(0, output, raw);
+	return (header_size == BLOCK_HEADER_SIZE && *crc != expected) ? -1 : 0;
+}
+
+/* Decoded bytes to the output, a NULL output is a sink for verification */
+int emit(const uint8_t* data, size_t length, FILE* output){
+	if(!output)
+		return 0;
+	uint64_t clock = stats_clock();
+	size_t written = fwrite(data, 1, length, output);
+	stats_time(STAT_WRITE, clock);
+	return (written == length) ? 0 : -1;
+}
+
+/* Where the next length bytes go in a mapped output, NULL when it isn't */
+uint8_t* sink_target(const MemberSink* sink, size_t length){
+	if(!sink || !sink->map.data || sink->position > sink->map.size || length > sink->map.size - sink->position)
+		return NULL;
+	return sink->map.data + sink->position;
+}
+
+/* Next decoded bytes, already in place when they came from sink_target */
+int sink_emit(MemberSink* sink, const uint8_t* data, size_t length){
+	if(!sink)
+		return 0;
+	if(!sink->map.data){
+		sink->position += length;
+		return emit(data, length, sink->file);
+	}
+
+	uint8_t* target = sink_target(sink, length);
+	if(!target)
+		return -1;
+	if(target != data)
+		memcpy(target, data, length);
+	sink->position += length;
+	return 0;
+}
+
+int frame_begin(BlockFrame* frame, FILE* out, int order, int mem_shift, Cipher* cipher){
+	memset(frame, 0, sizeof(BlockFrame));
+	frame->out = out;
+	frame->cipher = cipher;
+	frame->base = ftello(out);
+	frame->order = order;
+	frame->mem_shift = mem_shift;
+
+	uint8_t flags = FRAME_CHECKSUM | (cipher ? FRAME_ENCRYPTED : 0);
+	uint8_t header[FRAME_HEADER_SIZE] = {(uint8_t)(order | flags), (uint8_t)mem_shift};
+	if(fwrite(header, 1, FRAME_HEADER_SIZE, out) != FRAME_HEADER_SIZE)
+		frame->status = -1;
+	frame->size = FRAME_HEADER_SIZE;
+	return frame->status;
+}
+
+/* Append a record whose raw bytes have crc and remember it in the block
+ * table, with a digest it also becomes a target for later copies */
+int frame_block(BlockFrame* frame, const uint8_t* record, size_t length, const uint8_t* digest, uint32_t crc){
+	if(frame->count == frame->capacity){
+		uint64_t capacity = frame->capacity ? frame->capacity * 2 : 16;
+		uint8_t* table = realloc(frame->table, capacity * BLOCK_HEADER_SIZE);
+		if(!table){
+			frame->status = -1;
+			return -1;
+		}
+		frame->table = table;
+		frame->capacity = capacity;
+	}
+
+	memcpy(frame->table + frame->count * BLOCK_HEADER_SIZE, record, BLOCK_HEADER_SIZE);
+	frame->count++;
+	frame->total_raw += get_le32(record);
+	frame->checksum = crc32c_combine(frame->checksum, crc, get_le32(record));
+
+	if(digest && frame->dedup && frame->base >= 0 && get_le32(record + 4) != BLOCK_REF &&
+		dedup_add(frame->dedup, DEDUP_BLOCK, digest, (uint64_t)frame->base + frame->size,
+			(uint64_t)frame->order << 8 | (uint64_t)frame->mem_shift, crc) != 0)
+		frame->status = -1;
+
+	uint64_t clock = stats_clock();
+	if(fwrite(record, 1, length, frame->out) != length)
+		frame->status = -1;
+	stats_time(STAT_WRITE, clock);
+	frame->size += length;
+	return frame->status;
+}
+
+/* Write a reference when an identical block is already in the archive,
+ * an encrypted one leaves the crc to its sealed target */
+int frame_reference(BlockFrame* frame, const uint8_t* digest, uint32_t raw, uint32_t crc){
+	DedupEntry target;
+	if(!frame->dedup || !dedup_find(frame->dedup, DEDUP_BLOCK, digest, &target))
+		return 0;
+
+	uint8_t record[BLOCK_HEADER_SIZE + BLOCK_REF_SIZE];
+	put_le32(record, raw);
+	put_le32(record + 4, BLOCK_REF);
+	put_le32(record + 8, frame->cipher ? 0 : crc);
+	put_le64(record + BLOCK_HEADER_SIZE, target.offset);
+	record[BLOCK_HEADER_SIZE + 8] = (target.extra >> 8) & 0xFF;
+	record[BLOCK_HEADER_SIZE + 9] = target.extra & 0xFF;
+	frame_block(frame, record, sizeof(record), NULL, crc);
+	return 1;
+}
+
+/* End marker, block table and tail */
+int frame_end(BlockFrame* frame){
+	uint8_t tail[BLOCK_HEADER_SIZE + FRAME_TAIL_SIZE] = {0};
+	put_le64(tail + BLOCK_HEADER_SIZE, frame->count);
+	put_le64(tail + BLOCK_HEADER_SIZE + 8, frame->total_raw);
+
+	if(fwrite(tail, 1, BLOCK_HEADER_SIZE, frame->out) != BLOCK_HEADER_SIZE ||
+		(frame->count && fwrite(frame->table, BLOCK_HEADER_SIZE, frame->count, frame->out) != frame->count) ||
+		fwrite(tail + BLOCK_HEADER_SIZE, 1, FRAME_TAIL_SIZE, frame->out) != FRAME_TAIL_SIZE)
+		frame->status = -1;
+	frame->size += BLOCK_HEADER_SIZE + frame->count * BLOCK_HEADER_SIZE + FRAME_TAIL_SIZE;
+
+	free(frame->table);
+	frame->table = NULL;
+	return frame->status;
+}
+
+/* Stream input through the block coder, one block in memory at a time */
+int compress_stream(FILE* input, FILE* archive, uint64_t size_hint, int level, DedupTable* dedup, Cipher* cipher,
+	uint64_t* packed_size, uint64_t* raw_size, uint32_t* checksum){
+	int order;
+	int mem_shift = member_mem_shift(size_hint, level);
+	size_t block_cap = (size_hint < BLOCK_SIZE) ? (size_t)size_hint + 1 : BLOCK_SIZE;
+	uint8_t* block = malloc(block_cap);
+	uint8_t* record = malloc(record_bound(level, block_cap));
+	codec_level(level, &order);
+	if(!block || !record){
+		free(block);
+		free(record);
+		return -1;
+	}
+
+	/* Only split members share blocks, one-block members dedup whole */
+	BlockFrame frame;
+	uint8_t digest[SHA256_SIZE];
+	int status = frame_begin(&frame, archive, order, mem_shift, cipher);
+	frame.dedup = (size_hint > BLOCK_SIZE) ? dedup : NULL;
+	for(;status == 0;){
+		uint64_t clock = stats_clock();
+		size_t raw = fread(block, 1, block_cap, input);
+		stats_time(STAT_READ, clock);
+		if(raw == 0)
+			break;
+		clock = stats_clock();
+		uint32_t crc = crc32c(0, block, raw);
+		if(frame.dedup)
+			sha256(block, raw, digest);
+		stats_time(STAT_HASH, clock);
+		if(!frame.dedup || !frame_reference(&frame, digest, (uint32_t)raw, crc))
+			frame_block(&frame, record, encode_block(block, raw, level, mem_shift, crc, cipher, record), digest,
+				crc);
+		status = frame.status;
+	}
+	if(ferror(input))
+		status = -1;
+	if(frame_end(&frame) != 0)
+		status = -1;
+
+	free(block);
+	free(record);
+
+	*packed_size = frame.size;
+	*raw_size = frame.total_raw;
+	*checksum = frame.checksum;
+	return status;
+}
+
+/* Frame an in-memory or mapped input without staging it in a block buffer */
+int compress_buffer(const uint8_t* input, uint64_t size, FILE* archive, int level, DedupTable* dedup, Cipher* cipher,
+	uint64_t* packed_size, uint64_t* raw_size, uint32_t* checksum){
+	int order;
+	int mem_shift = member_mem_shift(size, level);
+	size_t block_cap = (size < BLOCK_SIZE) ? (size_t)size : BLOCK_SIZE;
+	uint8_t* record = malloc(record_bound(level, block_cap));
+	codec_level(level, &order);
+	if(!record)
+		return -1;
+
+	BlockFrame frame;
+	uint8_t digest[SHA256_SIZE];
+	int status = frame_begin(&frame, archive, order, mem_shift, cipher);
+	frame.dedup = (size > BLOCK_SIZE) ? dedup : NULL;
+	for(uint64_t done = 0; status == 0 && done < size;){
+		size_t raw = (size - done < block_cap) ? (size_t)(size - done) : block_cap;
+		uint64_t clock = stats_clock();
+		uint32_t crc = crc32c(0, input + done, raw);
+		if(frame.dedup)
+			sha256(input + done, raw, digest);
+		stats_time(STAT_HASH, clock);
+		if(!frame.dedup || !frame_reference(&frame, digest, (uint32_t)raw, crc))
+			frame_block(&frame, record, encode_block(input + done, raw, level, mem_shift, crc, cipher, record),
+				digest, crc);
+		status = frame.status;
+		done += raw;
+	}
+	if(frame_end(&frame) != 0)
+		status = -1;
+
+	free(record);
+
+	*packed_size = frame.size;
+	*raw_size = frame.total_raw;
+	*checksum = frame.checksum;
+	return status;
+}
+
+/* Decode a member block by block in stream order */
+int decompress_stream(FILE* archive, uint64_t packed_size, MemberSink* output, const Cipher* cipher,
+	uint32_t* checksum){
+	uint8_t header[BLOCK_HEADER_SIZE + FRAME_TAIL_SIZE];
+	if(packed_size < FRAME_HEADER_SIZE + LEGACY_BLOCK_HEADER_SIZE + FRAME_TAIL_SIZE ||
+		fread(header, 1, FRAME_HEADER_SIZE, archive) != FRAME_HEADER_SIZE)
+		return -1;
+
+	/* A password archive holds nothing but encrypted frames */
+	size_t header_size = (header[0] & FRAME_CHECKSUM) ? BLOCK_HEADER_SIZE : LEGACY_BLOCK_HEADER_SIZE;
+	int encrypted = (header[0] & FRAME_ENCRYPTED) != 0;
+	int order = header[0] & ~(FRAME_CHECKSUM | FRAME_ENCRYPTED);
+	int mem_shift = header[1];
+	if(order > PPM_MAX_ORDER || mem_shift > 40 || encrypted != (cipher != NULL) ||
+		(encrypted && header_size != BLOCK_HEADER_SIZE))
+		return -1;
+
+	/* A mapped output takes the blocks in place, no staging block needed,
+	 * sealed records are read into packed and open there */
+	size_t overhead = encrypted ? CIPHER_OVERHEAD : 0;
+	uint8_t* block = NULL;
+	uint8_t* packed = malloc(BLOCK_SIZE + overhead);
+	int status = -1;
+	uint64_t consumed = FRAME_HEADER_SIZE, total_raw = 0, count = 0;
+	uint32_t crc = 0;
+	*checksum = 0;
+
+	for(;packed;){
+		if(consumed + header_size > packed_size ||
+			fread(header, 1, header_size, archive) != header_size)
+			break;
+		consumed += header_size;
+
+		uint32_t raw = get_le32(header);
+		uint32_t length = get_le32(header + 4);
+		if(raw == 0){
+			/* End marker, read past the table (the archive may be a pipe) and check the tail */
+			uint64_t skipped = 0;
+			for(;length == 0 && skipped < count && fread(header, 1, header_size, archive) == header_size; skipped++);
+			if(length == 0 && skipped == count && fread(header, 1, FRAME_TAIL_SIZE, archive) == FRAME_TAIL_SIZE &&
+				get_le64(header) == count && get_le64(header + 8) == total_raw)
+				status = 0;
+			break;
+		}
+
+		uint32_t size = record_size(length, overhead);
+		if(raw > BLOCK_SIZE || (size > raw + overhead && length != BLOCK_REF) || consumed + size > packed_size ||
+			fread(packed, 1, size, archive) != size)
+			break;
+		consumed += size;
+
+		uint8_t* target = sink_target(output, raw);
+		if(!target && !block && !(block = malloc(BLOCK_SIZE)))
+			break;
+		if(!target)
+			target = block;
+		if(decode_checked(fileno(archive), header, header_size, packed, target, order, mem_shift, cipher,
+			packed + CIPHER_NONCE_SIZE, &crc) != 0 ||
+			sink_emit(output, target, raw) != 0)
+			break;
+		*checksum = crc32c_combine(*checksum, crc, raw);
+		total_raw += raw;
+		count++;
+	}
+
+	free(block);
+	free(packed);
+	return status;
+}
+
+/* Bytes of a member payload, from the mapping when there is one */
+int member_read(const MappedFile* map, int fd, off_t start, uint64_t at, uint8_t* dst, size_t length){
+	if(map->data){
+		memcpy(dst, map->data + at, length);
+		return 0;
+	}
+	return (pread(fd, dst, length, start + (off_t)at) == (ssize_t)length) ? 0 : -1;
+}
+
+/* Decode a member's blocks on several threads, written out in order */
+int decompress_parallel(FILE* archive, uint64_t packed_size, MemberSink* output, int threads, const Cipher* cipher,
+	uint32_t* checksum){
+	off_t start = ftello(archive);
+	uint8_t header[FRAME_TAIL_SIZE];
+	int fd = fileno(archive);
+
+	/* Blocks are decoded straight out of the page cache when the archive maps */
+	MappedFile map;
+	if(start < 0 || map_range(fd, (uint64_t)start, packed_size, 0, &map) != 0)
+		memset(&map, 0, sizeof(MappedFile));
+
+	uint8_t frame_header[FRAME_HEADER_SIZE];
+	if((threads <= 1 && !map.data) || packed_size < FRAME_HEADER_SIZE + LEGACY_BLOCK_HEADER_SIZE + FRAME_TAIL_SIZE ||
+		member_read(&map, fd, start, packed_size - FRAME_TAIL_SIZE, header, FRAME_TAIL_SIZE) != 0 ||
+		member_read(&map, fd, start, 0, frame_header, FRAME_HEADER_SIZE) != 0){
+		map_release(&map);
+		return decompress_stream(archive, packed_size, output, cipher, checksum);
+	}
+
+	/* Small members gain nothing from the thread round trip */
+	size_t header_size = (frame_header[0] & FRAME_CHECKSUM) ? BLOCK_HEADER_SIZE : LEGACY_BLOCK_HEADER_SIZE;
+	uint64_t count = get_le64(header);
+	if((count < 2 && !map.data) || count > packed_size / header_size){
+		map_release(&map);
+		return decompress_stream(archive, packed_size, output, cipher, checksum);
+	}
+
+	uint64_t table_size = count * header_size;
+	BlockDecoder decoder = {0};
+	uint8_t* table = malloc(table_size ? table_size : 1);
+	decoder.offsets = calloc(count ? count : 1, sizeof(off_t));
+	decoder.results = calloc(count ? count : 1, sizeof(uint8_t*));
+	decoder.checksums = calloc(count ? count : 1, sizeof(uint32_t));
+	decoder.positions = calloc(count ? count : 1, sizeof(uint64_t));
+	if(!table || !decoder.offsets || !decoder.results || !decoder.checksums || !decoder.positions ||
+		member_read(&map, fd, start, packed_size - FRAME_TAIL_SIZE - table_size, table, table_size) != 0){
+		free(table);
+		free(decoder.offsets);
+		free(decoder.results);
+		free(decoder.checksums);
+		free(decoder.positions);
+		map_release(&map);
+		return -1;
+	}
+
+	/* Resolve record and output positions from the table and check they add up,
+	 * a password archive holds nothing but encrypted frames */
+	int encrypted = (frame_header[0] & FRAME_ENCRYPTED) != 0;
+	size_t overhead = encrypted ? CIPHER_OVERHEAD : 0;
+	off_t position = start + FRAME_HEADER_SIZE;
+	uint64_t total_raw = 0;
+	uint32_t largest = 0;
+	int valid = (frame_header[0] & ~(FRAME_CHECKSUM | FRAME_ENCRYPTED)) <= PPM_MAX_ORDER && frame_header[1] <= 40 &&
+		encrypted == (cipher != NULL) && (!encrypted || header_size == BLOCK_HEADER_SIZE);
+	for(uint64_t i = 0; i < count && valid; i++){
+		uint32_t raw = get_le32(table + i * header_size);
+		uint32_t length = get_le32(table + i * header_size + 4);
+		valid = raw > 0 && raw <= BLOCK_SIZE && (record_size(length, overhead) <= raw + overhead || length == BLOCK_REF);
+		decoder.offsets[i] = position + (off_t)header_size;
+		decoder.positions[i] = total_raw;
+		position += (off_t)(header_size + record_size(length, overhead));
+		total_raw += raw;
+		largest = (raw > largest) ? raw : largest;
+	}
+	if(!valid || (uint64_t)(position - start) + header_size + table_size + FRAME_TAIL_SIZE != packed_size){
+		free(table);
+		free(decoder.offsets);
+		free(decoder.results);
+		free(decoder.checksums);
+		free(decoder.positions);
+		map_release(&map);
+		return -1;
+	}
+	decoder.output = (total_raw <= SIZE_MAX) ? sink_target(output, (size_t)total_raw) : NULL;
+
+	decoder.fd = fd;
+	decoder.start = start;
+	decoder.source = map.data;
+	decoder.order = frame_header[0] & ~(FRAME_CHECKSUM | FRAME_ENCRYPTED);
+	decoder.mem_shift = frame_header[1];
+	decoder.header_size = header_size;
+	decoder.cipher = cipher;
+	decoder.table = table;
+	decoder.count = count;
+	decoder.window = (uint64_t)threads * BLOCKS_PER_THREAD;
+	pthread_mutex_init(&decoder.lock, NULL);
+	pthread_cond_init(&decoder.changed, NULL);
+
+	/* One block or one thread, decode in place without workers */
+	if(threads < 1 || count < 2)
+		threads = 1;
+	if((uint64_t)threads > count)
+		threads = (int)count;
+	pthread_t workers[threads];
+	int started = 0;
+	for(;threads > 1 && started < threads; started++)
+		if(pthread_create(&workers[started], NULL, block_worker, &decoder) != 0)
+			break;
+
+	/* Without workers blocks decode in place, or through one block sized to the largest,
+	 * sealed records open into another from the read-only mapping */
+	int status = (started || threads == 1) ? 0 : -1;
+	uint8_t* serial = (started == 0 && status == 0 && !decoder.output) ? malloc(largest ? largest : 1) : NULL;
+	uint8_t* scratch = (started == 0 && status == 0 && cipher) ? malloc(largest ? largest : 1) : NULL;
+	if(started == 0 && ((!serial && !decoder.output) || (!scratch && cipher)))
+		status = -1;
+	*checksum = 0;
+	for(uint64_t i = 0; i < count && status == 0; i++){
+		const uint8_t* entry = table + i * header_size;
+		uint32_t raw = get_le32(entry);
+		if(started == 0){
+			uint8_t* target = decoder.output ? decoder.output + decoder.positions[i] : serial;
+			if(decode_checked(fd, entry, header_size, decoder.source + (decoder.offsets[i] - start), target,
+				decoder.order, decoder.mem_shift, cipher, scratch, &decoder.checksums[i]) != 0 ||
+				sink_emit(output, target, raw) != 0)
+				status = -1;
+			*checksum = crc32c_combine(*checksum, decoder.checksums[i], raw);
+			continue;
+		}
+
+		pthread_mutex_lock(&decoder.lock);
+		for(;!decoder.results[i] && !decoder.failed;)
+			pthread_cond_wait(&decoder.changed, &decoder.lock);
+		uint8_t* block = decoder.results[i];
+		pthread_mutex_unlock(&decoder.lock);
+
+		if(!block){
+			status = -1;
+			break;
+		}
+
+		if(sink_emit(output, block, raw) != 0)
+			status = -1;
+		*checksum = crc32c_combine(*checksum, decoder.checksums[i], raw);
+		if(!decoder.output)
+			free(block);
+
+		pthread_mutex_lock(&decoder.lock);
+		decoder.results[i] = NULL;
+		decoder.written++;
+		if(status != 0)
+			decoder.failed = 1;
+		pthread_cond_broadcast(&decoder.changed);
+		pthread_mutex_unlock(&decoder.lock);
+	}
+	free(serial);
+	free(scratch);
+
+	pthread_mutex_lock(&decoder.lock);
+	decoder.failed |= (status != 0);
+	pthread_cond_broadcast(&decoder.changed);
+	pthread_mutex_unlock(&decoder.lock);
+	for(int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	/* Leftovers exist only after a failure */
+	for(uint64_t i = 0; i < count && !decoder.output; i++)
+		free(decoder.results[i]);
+
+	pthread_mutex_destroy(&decoder.lock);
+	pthread_cond_destroy(&decoder.changed);
+	free(table);
+	free(decoder.offsets);
+	free(decoder.results);
+	free(decoder.checksums);
+	free(decoder.positions);
+	map_release(&map);
+
+	fseeko(archive, start + (off_t)packed_size, SEEK_SET);
+	return status;
+}
+
+/* Decode blocks ahead of the writer, at most window of them */
+void* block_worker(void* arg){
+	BlockDecoder* decoder = arg;
+	size_t overhead = decoder->cipher ? CIPHER_OVERHEAD : 0;
+	uint8_t* packed = decoder->source ? NULL : malloc(BLOCK_SIZE + overhead);
+
+	/* Sealed records open in place once read, out of a mapping into scratch */
+	uint8_t* scratch = (decoder->source && decoder->cipher) ? malloc(BLOCK_SIZE) : NULL;
+	if(decoder->cipher && !decoder->source)
+		scratch = packed ? packed + CIPHER_NONCE_SIZE : NULL;
+	int ready = (packed || decoder->source) && (scratch || !decoder->cipher);
+
+	pthread_mutex_lock(&decoder->lock);
+	for(;ready;){
+		for(;decoder->next < decoder->count && decoder->next - decoder->written >= decoder->window &&
+			!decoder->failed;)
+			pthread_cond_wait(&decoder->changed, &decoder->lock);
+		if(decoder->next >= decoder->count || decoder->failed)
+			break;
+
+		uint64_t i = decoder->next++;
+		pthread_mutex_unlock(&decoder->lock);
+
+		const uint8_t* entry = decoder->table + i * decoder->header_size;
+		uint32_t raw = get_le32(entry);
+		uint32_t size = record_size(get_le32(entry + 4), overhead);
+		uint8_t* block = decoder->output ? decoder->output + decoder->positions[i] : malloc(raw);
+		const uint8_t* record = decoder->source ? decoder->source + (decoder->offsets[i] - decoder->start) : packed;
+		uint32_t crc = 0;
+		if(block && ((!decoder->source && pread(decoder->fd, packed, size, decoder->offsets[i]) != (ssize_t)size) ||
+			decode_checked(decoder->fd, entry, decoder->header_size, record, block, decoder->order,
+				decoder->mem_shift, decoder->cipher, scratch, &crc) != 0)){
+			if(!decoder->output)
+				free(block);
+			block = NULL;
+		}
+
+		pthread_mutex_lock(&decoder->lock);
+		decoder->checksums[i] = crc;
+		if(block)
+			decoder->results[i] = block;
+		else
+			decoder->failed = 1;
+		pthread_cond_broadcast(&decoder->changed);
+	}
+	if(!ready)
+		decoder->failed = 1;
+	pthread_cond_broadcast(&decoder->changed);
+	pthread_mutex_unlock(&decoder->lock);
+
+	if(decoder->source)
+		free(scratch);
+	free(packed);
+	return NULL;
+}
+
+/* Copy length bytes (or up to EOF) through a fixed buffer */
+int copy_stream(FILE* input, FILE* output, uint64_t length, uint64_t* copied, uint32_t* checksum){
+	uint8_t buffer[BUFFER * 16];
+	uint64_t done = 0;
+
+	for(;done < length;){
+		size_t want = (length - done < sizeof(buffer)) ? (size_t)(length - done) : sizeof(buffer);
+		size_t got = fread(buffer, 1, want, input);
+		if(got == 0)
+			break;
+		if(emit(buffer, got, output) != 0)
+			return -1;
+		if(checksum)
+			*checksum = crc32c(*checksum, buffer, got);
+		done += got;
+	}
+
+	if(copied)
+		*copied = done;
+	if(ferror(input))
+		return -1;
+	return (length == UINT64_MAX || done == length) ? 0 : -1;
+}
+
+/* Stored member straight from the mapped archive, stdio when it won't map */
+int copy_member(FILE* archive, uint64_t length, MemberSink* output, uint32_t* checksum){
+	off_t start = ftello(archive);
+	MappedFile map;
+	*checksum = 0;
+	if(start < 0 || map_range(fileno(archive), (uint64_t)start, length, 0, &map) != 0){
+		uint8_t* target = (length <= SIZE_MAX) ? sink_target(output, (size_t)length) : NULL;
+		if(!target){
+			int status = copy_stream(archive, output ? output->file : NULL, length, NULL, checksum);
+			if(output)
+				output->position += length;
+			return status;
+		}
+
+		/* Mapped output, read straight into it */
+		if(fread(target, 1, (size_t)length, archive) != length)
+			return -1;
+		*checksum = crc32c(0, target, (size_t)length);
+		return sink_emit(output, target, (size_t)length);
+	}
+
+	*checksum = crc32c(0, map.data, map.size);
+	int status = sink_emit(output, map.data, map.size);
+	map_release(&map);
+	fseeko(archive, start + (off_t)length, SEEK_SET);
+	return status;
+}
+
+/* Legacy run-length decoder for archives written before the PPM engine */
+size_t rle_decompress(const uint8_t* input, size_t input_size, uint8_t** output) {
+	if (input_size < 4 || !input || !output) {
+		*output = NULL;
+		return 0;
+	}
+
+	/* Read original size from header */
+	size_t original_size = ((size_t)input[0] << 24) | (input[1] << 16) | (input[2] << 8) | input[3];
+
+	if (original_size == 0) {
+		*output = NULL;
+		return 0;
+	}
+
+	uint8_t* decompressed = malloc(original_size);
+	if (!decompressed) {
+		*output = NULL;
+		return 0;
+	}
+
+	size_t decomp_index = 0;
+	size_t comp_index = 4;
+
+	for(;comp_index < input_size && decomp_index < original_size;){
+		if (comp_index + 2 < input_size && input[comp_index] == input[comp_index + 1]) {
+			/* Decode run */
+			uint8_t value = input[comp_index];
+			uint8_t count = input[comp_index + 2];
+
+			for (uint8_t j = 0; j < count && decomp_index < original_size; j++)
+				decompressed[decomp_index++] = value;
+			comp_index += 3;
+		} else
+			/* Copy literal */
+			decompressed[decomp_index++] = input[comp_index++];
+	}
+
+	*output = decompressed;
+	return decomp_index;
+}
+
+/* Legacy members carry a 32-bit size and are decoded in one piece */
+int rle_decompress_member(FILE* archive, uint64_t packed_size, MemberSink* output, uint32_t* checksum){
+	if(packed_size > UINT32_MAX + (uint64_t)4)
+		return -1;
+
+	uint8_t* packed = malloc(packed_size);
+	if(!packed)
+		return -1;
+
+	uint8_t* data = NULL;
+	size_t size = 0;
+	if(fread(packed, 1, packed_size, archive) == packed_size)
+		size = rle_decompress(packed, packed_size, &data);
+	free(packed);
+
+	int status = (data && size > 0 && sink_emit(output, data, size) == 0) ? 0 : -1;
+	*checksum = data ? crc32c(0, data, size) : 0;
+	free(data);
+	return status;
+}
@@ -0,0 +1,171 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include "lib.h"
+#include "ppm.h"
+#include "mapfile.h"
+#include "dedup.h"
+#include "crc32c.h"
+#include "fastrle.h"
+#include "stats.h"
+#include "crypto.h"
+
+/* defines */
+#define ALGO_RLE 1                /* legacy run-length coder, flagged as PPM by old builds */
+#define ALGO_PPM 2                /* order-N PPM with range coder */
+#define ALGO_LINK 3               /* copy of an earlier member, payload is its offset */
+#define ALGO_FAST 4               /* block frame coded at the fast level */
+#define LINK_SIZE 8               /* 64-bit offset of the linked FileHeader */
+#define BLOCK_REF 0xFFFFFFFFu     /* packed length of a record that repeats an earlier one */
+#define BLOCK_REF_SIZE 10         /* 64-bit record offset, order, mem_shift */
+#define BLOCK_CODEC_SHIFT 24      /* packed length bits from here up name the block coder */
+#define BLOCK_LENGTH_MASK 0x00FFFFFFu
+#define BLOCK_CODEC_PPM 0
+#define BLOCK_CODEC_FAST 1        /* SIMD run-length coder */
+#define LEVEL_STORE 0             /* no coder at all */
+#define LEVEL_FAST 1              /* run-length blocks */
+#define LEVEL_DEFAULT 5           /* PPM at PPM_DEFAULT_ORDER */
+#define LEVEL_MAX 9
+#define LEVEL_ORDER_TOP 6         /* last level adding PPM order, the ones past it double the model memory */
+#define BLOCK_SIZE (4UL << 20)    /* independently coded unit of a member */
+#define BLOCK_HEADER_SIZE 12      /* 32-bit raw and packed length, CRC32C of the raw bytes */
+#define LEGACY_BLOCK_HEADER_SIZE 8    /* records of frames written without checksums */
+#define FRAME_HEADER_SIZE 2       /* PPM order, log2 of the model memory */
+#define FRAME_CHECKSUM 0x80       /* order byte flag, records carry a CRC32C */
+#define FRAME_ENCRYPTED 0x40      /* order byte flag, record data is sealed with AES-256-GCM */
+#define FRAME_TAIL_SIZE 16        /* 64-bit block count and original size */
+#define BLOCKS_PER_THREAD 2       /* decoded blocks in flight per worker */
+#define SAMPLE_WINDOWS 8          /* windows the entropy estimate looks at */
+#define SAMPLE_WINDOW_SIZE 4096
+#define SAMPLE_MIN_SIZE 1024      /* below this just try the coder */
+#define SAMPLE_HASH_BITS 12
+#define SAMPLE_HASH_SIZE (1 << SAMPLE_HASH_BITS)
+#define SAMPLE_REPEAT_RATIO 64    /* one 4-byte repeat per 64 bytes is structure */
+#define ENTROPY_STORE 7.8         /* bits per byte above which data is stored */
+#define ENTROPY_HINT_STORE 7.0    /* same, for extensions known to be packed */
+#define BLOCK_RUNS_RATIO 256      /* sample the run coder shrinks this far needs no model */
+
+/* block_class verdicts */
+#define BLOCK_CLASS_STORE 0       /* sampled noise, no coder */
+#define BLOCK_CLASS_CODE 1        /* the coder of the level */
+#define BLOCK_CLASS_RUNS 2        /* nearly all runs, the run coder at any level */
+
+/* Block framing of a member payload:
+ * order, mem_shift, {raw, packed, crc, data}..., {0, 0, 0},
+ * block table of {raw, packed, crc}..., block count, original size.
+ * A record with packed == BLOCK_REF carries the archive offset of an
+ * identical earlier record instead of data, otherwise the top byte of
+ * packed names the block coder, packed == raw is stored. Every block
+ * picks its own, so one member can mix all three.
+ * In encrypted frames data is nonce, sealed bytes, tag with the record
+ * header as associated data, and the crc is masked by the record key */
+typedef struct {
+	FILE* out;
+	DedupTable* dedup;        /* block digests of this archive, NULL for none */
+	Cipher* cipher;           /* key of an encrypted frame, NULL for none */
+	off_t base;               /* archive position of the payload */
+	int order;
+	int mem_shift;
+	uint8_t* table;           /* {raw, packed} pairs, little-endian */
+	uint64_t count;
+	uint64_t capacity;
+	uint64_t total_raw;
+	uint32_t checksum;        /* CRC32C of the original bytes so far */
+	uint64_t size;            /* payload bytes written so far */
+	int status;
+} BlockFrame;
+
+/* Destination of a decoded member: its preallocated file mapped, where
+ * blocks are decoded in place, a stdio stream, or neither to only check it */
+typedef struct {
+	FILE* file;
+	OutputMap map;
+	uint64_t position;        /* bytes produced so far */
+} MemberSink;
+
+/* Member coder, found by the algorithm byte of its FileHeader. Block
+ * coders compress into at most capacity bytes (0 when the block does
+ * not shrink) and need bound(raw) bytes of room for any input */
+typedef struct {
+	uint8_t algorithm;
+	uint8_t block_tag;        /* top byte of the packed length of its records */
+	const char* name;
+	size_t (*compress)(const uint8_t* input, size_t raw, int order, int mem_shift, uint8_t* output, size_t capacity);
+	int (*decompress)(const uint8_t* packed, size_t length, uint8_t* output, size_t raw, int order, int mem_shift);
+	size_t (*bound)(size_t raw);
+	int (*decode_member)(FILE* archive, uint64_t packed_size, MemberSink* output, int threads, const Cipher* cipher,
+		uint32_t* checksum);
+} Codec;
+
+/* Parallel decoder state for one member */
+typedef struct {
+	int fd;
+	off_t start;              /* member payload position */
+	const uint8_t* source;    /* mapped payload, NULL reads with pread */
+	int order;
+	int mem_shift;
+	size_t header_size;       /* record header, legacy frames have no CRC */
+	const Cipher* cipher;     /* key of an encrypted frame */
+	const uint8_t* table;
+	uint32_t* checksums;      /* CRC32C of every decoded block */
+	off_t* offsets;           /* packed data position of every block */
+	uint8_t** results;
+	uint8_t* output;          /* mapped output of the member, blocks decode in place */
+	uint64_t* positions;      /* output offset of every block */
+	uint64_t count;
+	uint64_t next;
+	uint64_t written;
+	uint64_t window;
+	int failed;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} BlockDecoder;
+
+/* Sampled windows and their byte histogram */
+typedef struct {
+	uint8_t data[SAMPLE_WINDOWS * SAMPLE_WINDOW_SIZE];
+	uint32_t counts[4][256];
+	uint64_t total;
+	uint64_t repeats;
+} EntropySample;
+
+/* Function declarations */
+int member_mem_shift(uint64_t size_hint, int level);
+int data_compressible(const uint8_t* data, uint64_t size, int hint);
+int file_compressible(int fd, uint64_t size, int hint);
+int block_class(const uint8_t* data, uint64_t size);
+const Codec* codec_find(uint8_t algorithm);
+const Codec* codec_block(uint32_t tag);
+const Codec* codec_level(int level, int* order);
+size_t record_bound(int level, size_t raw);
+size_t encode_block(const uint8_t* input, size_t raw, int level, int mem_shift, uint32_t crc, Cipher* cipher,
+	uint8_t* record);
+int frame_begin(BlockFrame* frame, FILE* out, int order, int mem_shift, Cipher* cipher);
+int frame_block(BlockFrame* frame, const uint8_t* record, size_t length, const uint8_t* digest, uint32_t crc);
+int frame_reference(BlockFrame* frame, const uint8_t* digest, uint32_t raw, uint32_t crc);
+int frame_end(BlockFrame* frame);
+int compress_stream(FILE* input, FILE* archive, uint64_t size_hint, int level, DedupTable* dedup, Cipher* cipher,
+	uint64_t* packed_size, uint64_t* raw_size, uint32_t* checksum);
+int compress_buffer(const uint8_t* input, uint64_t size, FILE* archive, int level, DedupTable* dedup, Cipher* cipher,
+	uint64_t* packed_size, uint64_t* raw_size, uint32_t* checksum);
+int decompress_stream(FILE* archive, uint64_t packed_size, MemberSink* output, const Cipher* cipher,
+	uint32_t* checksum);
+int decompress_parallel(FILE* archive, uint64_t packed_size, MemberSink* output, int threads, const Cipher* cipher,
+	uint32_t* checksum);
+int copy_stream(FILE* input, FILE* output, uint64_t length, uint64_t* copied, uint32_t* checksum);
+int copy_member(FILE* archive, uint64_t length, MemberSink* output, uint32_t* checksum);
+int rle_decompress_member(FILE* archive, uint64_t packed_size, MemberSink* output, uint32_t* checksum);
+
+#endif
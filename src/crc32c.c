@@ -0,0 +1,122 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+static void crc32c_setup(void);
+static uint32_t crc32c_portable(uint32_t crc, const uint8_t* data, size_t length);
+static uint32_t gf2_times(const uint32_t* matrix, uint32_t vector);
+static void gf2_square(uint32_t* square, const uint32_t* matrix);
+
+static uint32_t table[8][256];
+static uint32_t (*crc32c_update)(uint32_t crc, const uint8_t* data, size_t length) = crc32c_portable;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+#ifdef CRC32C_HAVE_SSE42
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t length);
+
+/* Eight bytes per crc32 instruction, unaligned head and tail bytewise */
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t length){
+	for(;length && ((uintptr_t)data & 7); length--)
+		crc = _mm_crc32_u8(crc, *data++);
+#if defined(__x86_64__)
+	uint64_t wide = crc;
+	for(;length >= 8; data += 8, length -= 8)
+		wide = _mm_crc32_u64(wide, *(const uint64_t*)data);
+	crc = (uint32_t)wide;
+#else
+	for(;length >= 4; data += 4, length -= 4)
+		crc = _mm_crc32_u32(crc, *(const uint32_t*)data);
+#endif
+	for(;length; length--)
+		crc = _mm_crc32_u8(crc, *data++);
+	return crc;
+}
+#endif
+
+/* Slicing tables, and the instruction when the CPU has it */
+void crc32c_setup(void){
+	for(uint32_t i = 0; i < 256; i++){
+		uint32_t crc = i;
+		for(int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+		table[0][i] = crc;
+	}
+	for(uint32_t i = 0; i < 256; i++)
+		for(int slice = 1; slice < 8; slice++)
+			table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+
+#ifdef CRC32C_HAVE_SSE42
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse4.2"))
+		crc32c_update = crc32c_sse42;
+#endif
+}
+
+/* Slicing-by-8 for CPUs without the instruction */
+uint32_t crc32c_portable(uint32_t crc, const uint8_t* data, size_t length){
+	for(;length >= 8; data += 8, length -= 8){
+		uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+			(uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+			table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+			table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+	}
+	for(;length; length--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+	return crc;
+}
+
+/* Running checksum, start from 0 */
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t length){
+	pthread_once(&crc32c_once, crc32c_setup);
+	return ~crc32c_update(~crc, data, length);
+}
+
+uint32_t gf2_times(const uint32_t* matrix, uint32_t vector){
+	uint32_t sum = 0;
+	for(;vector; vector >>= 1, matrix++)
+		if(vector & 1)
+			sum ^= *matrix;
+	return sum;
+}
+
+void gf2_square(uint32_t* square, const uint32_t* matrix){
+	for(int n = 0; n < 32; n++)
+		square[n] = gf2_times(matrix, matrix[n]);
+}
+
+/* Checksum of A followed by B from the checksums of both, so
+ * blocks coded on different threads still give a member checksum */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t length2){
+	uint32_t even[32], odd[32];
+	if(length2 == 0)
+		return crc1;
+
+	/* Operator for one zero bit, then squared up to one zero byte */
+	odd[0] = CRC32C_POLY;
+	for(int n = 1; n < 32; n++)
+		odd[n] = 1u << (n - 1);
+	gf2_square(even, odd);
+	gf2_square(odd, even);
+
+	for(;;){
+		gf2_square(even, odd);
+		if(length2 & 1)
+			crc1 = gf2_times(even, crc1);
+		length2 >>= 1;
+		if(!length2)
+			break;
+
+		gf2_square(odd, even);
+		if(length2 & 1)
+			crc1 = gf2_times(odd, crc1);
+		length2 >>= 1;
+		if(!length2)
+			break;
+	}
+	return crc1 ^ crc2;
+}
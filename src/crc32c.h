@@ -0,0 +1,16 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <pthread.h>
+
+/* defines */
+#define CRC32C_POLY 0x82F63B78u   /* Castagnoli, reflected */
+
+/* Function declarations */
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t length);
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t length2);
+
+#endif
@@ -0,0 +1,516 @@
+#include "crypto.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CIPHER_HAVE_X86 1
+#endif
+
+#define GCM_CHUNK 4096  /* bytes encrypted then hashed while still in cache */
+
+static void cipher_setup(void);
+static uint32_t get_be32(const uint8_t* src);
+static void put_be32(uint8_t* dst, uint32_t value);
+static void put_be64(uint8_t* dst, uint64_t value);
+static void aes_expand(Cipher* cipher, const uint8_t key[CIPHER_KEY_SIZE]);
+static void aes_block_portable(const Cipher* cipher, const uint8_t input[16], uint8_t output[16]);
+static void ctr_portable(const Cipher* cipher, uint8_t counter[16], const uint8_t* input, uint8_t* output,
+	size_t length);
+static void ghash_tables(Cipher* cipher);
+static void ghash_portable(const Cipher* cipher, uint8_t state[16], const uint8_t* data, size_t length);
+static void gcm_counter(const uint8_t nonce[CIPHER_NONCE_SIZE], uint32_t block, uint8_t counter[16]);
+static void gcm_tag(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE], uint8_t state[16],
+	size_t aad_length, size_t length, uint8_t tag[16]);
+static void hmac_keys(Sha256* inner, Sha256* outer, const uint8_t* key, size_t length);
+static void hmac_finish(const Sha256* inner, const Sha256* outer, const uint8_t* data, size_t length,
+	uint8_t digest[SHA256_SIZE]);
+
+static uint8_t sbox[256];
+static uint32_t te[4][256];
+static const uint16_t last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static void (*aes_block)(const Cipher* cipher, const uint8_t input[16], uint8_t output[16]) = aes_block_portable;
+static void (*ctr_update)(const Cipher* cipher, uint8_t counter[16], const uint8_t* input, uint8_t* output,
+	size_t length) = ctr_portable;
+static void (*ghash_update)(const Cipher* cipher, uint8_t state[16], const uint8_t* data, size_t length) =
+	ghash_portable;
+static pthread_once_t cipher_once = PTHREAD_ONCE_INIT;
+
+#ifdef CIPHER_HAVE_X86
+static void aes_block_ni(const Cipher* cipher, const uint8_t input[16], uint8_t output[16]);
+static void ctr_ni(const Cipher* cipher, uint8_t counter[16], const uint8_t* input, uint8_t* output, size_t length);
+static void ghash_clmul(const Cipher* cipher, uint8_t state[16], const uint8_t* data, size_t length);
+static __m128i gf_multiply(__m128i a, __m128i b);
+
+__attribute__((target("aes,sse2")))
+void aes_block_ni(const Cipher* cipher, const uint8_t input[16], uint8_t output[16]){
+	const __m128i* keys = (const __m128i*)cipher->round_keys;
+	__m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)input), _mm_loadu_si128(keys));
+	for(int round = 1; round < CIPHER_ROUNDS; round++)
+		block = _mm_aesenc_si128(block, _mm_loadu_si128(keys + round));
+	block = _mm_aesenclast_si128(block, _mm_loadu_si128(keys + CIPHER_ROUNDS));
+	_mm_storeu_si128((__m128i*)output, block);
+}
+
+/* Eight counter blocks in flight, the 32-bit big-endian counter sits
+ * in the low lane once the block is byte reversed */
+__attribute__((target("aes,ssse3")))
+void ctr_ni(const Cipher* cipher, uint8_t counter[16], const uint8_t* input, uint8_t* output, size_t length){
+	const __m128i* keys = (const __m128i*)cipher->round_keys;
+	const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i key[CIPHER_ROUNDS + 1];
+	for(int round = 0; round <= CIPHER_ROUNDS; round++)
+		key[round] = _mm_loadu_si128(keys + round);
+	__m128i next = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)counter), reverse);
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+
+	for(;length >= 128; input += 128, output += 128, length -= 128){
+		__m128i block[8];
+		for(int i = 0; i < 8; i++){
+			block[i] = _mm_xor_si128(_mm_shuffle_epi8(next, reverse), key[0]);
+			next = _mm_add_epi32(next, one);
+		}
+		for(int round = 1; round < CIPHER_ROUNDS; round++)
+			for(int i = 0; i < 8; i++)
+				block[i] = _mm_aesenc_si128(block[i], key[round]);
+		for(int i = 0; i < 8; i++){
+			block[i] = _mm_aesenclast_si128(block[i], key[CIPHER_ROUNDS]);
+			block[i] = _mm_xor_si128(block[i], _mm_loadu_si128((const __m128i*)input + i));
+			_mm_storeu_si128((__m128i*)output + i, block[i]);
+		}
+	}
+	for(;length;){
+		__m128i block = _mm_xor_si128(_mm_shuffle_epi8(next, reverse), key[0]);
+		next = _mm_add_epi32(next, one);
+		for(int round = 1; round < CIPHER_ROUNDS; round++)
+			block = _mm_aesenc_si128(block, key[round]);
+		block = _mm_aesenclast_si128(block, key[CIPHER_ROUNDS]);
+		size_t step = (length < 16) ? length : 16;
+		uint8_t stream[16];
+		_mm_storeu_si128((__m128i*)stream, block);
+		for(size_t i = 0; i < step; i++)
+			output[i] = input[i] ^ stream[i];
+		input += step;
+		output += step;
+		length -= step;
+	}
+	_mm_storeu_si128((__m128i*)counter, _mm_shuffle_epi8(next, reverse));
+}
+
+/* Carry-less product of two byte-reversed field elements, shifted
+ * back into the reflected GCM bit order and reduced */
+__attribute__((target("pclmul,sse2")))
+__m128i gf_multiply(__m128i a, __m128i b){
+	__m128i low = _mm_clmulepi64_si128(a, b, 0x00);
+	__m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+	__m128i high = _mm_clmulepi64_si128(a, b, 0x11);
+	low = _mm_xor_si128(low, _mm_slli_si128(middle, 8));
+	high = _mm_xor_si128(high, _mm_srli_si128(middle, 8));
+
+	__m128i carry_low = _mm_srli_epi32(low, 31);
+	__m128i carry_high = _mm_srli_epi32(high, 31);
+	low = _mm_slli_epi32(low, 1);
+	high = _mm_slli_epi32(high, 1);
+	__m128i across = _mm_srli_si128(carry_low, 12);
+	low = _mm_or_si128(low, _mm_slli_si128(carry_low, 4));
+	high = _mm_or_si128(high, _mm_or_si128(_mm_slli_si128(carry_high, 4), across));
+
+	__m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)),
+		_mm_slli_epi32(low, 25));
+	__m128i spill = _mm_srli_si128(fold, 4);
+	low = _mm_xor_si128(low, _mm_slli_si128(fold, 12));
+	__m128i mix = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)),
+		_mm_srli_epi32(low, 7));
+	low = _mm_xor_si128(low, _mm_xor_si128(mix, spill));
+	return _mm_xor_si128(high, low);
+}
+
+__attribute__((target("pclmul,ssse3")))
+void ghash_clmul(const Cipher* cipher, uint8_t state[16], const uint8_t* data, size_t length){
+	const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i key = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)cipher->hash_key), reverse);
+	__m128i sum = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)state), reverse);
+	for(;length >= 16; data += 16, length -= 16){
+		__m128i block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), reverse);
+		sum = gf_multiply(_mm_xor_si128(sum, block), key);
+	}
+	if(length){
+		uint8_t last[16] = {0};
+		memcpy(last, data, length);
+		__m128i block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)last), reverse);
+		sum = gf_multiply(_mm_xor_si128(sum, block), key);
+	}
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi8(sum, reverse));
+}
+#endif
+
+uint32_t get_be32(const uint8_t* src){
+	return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | src[3];
+}
+
+void put_be32(uint8_t* dst, uint32_t value){
+	dst[0] = (uint8_t)(value >> 24);
+	dst[1] = (uint8_t)(value >> 16);
+	dst[2] = (uint8_t)(value >> 8);
+	dst[3] = (uint8_t)value;
+}
+
+void put_be64(uint8_t* dst, uint64_t value){
+	put_be32(dst, (uint32_t)(value >> 32));
+	put_be32(dst + 4, (uint32_t)value);
+}
+
+/* S-box from the multiplicative inverse walk, round tables from it,
+ * and the instructions when the CPU has them */
+void cipher_setup(void){
+	uint8_t p = 1, q = 1;
+	do {
+		p = p ^ (uint8_t)(p << 1) ^ ((p & 0x80) ? 0x1B : 0);
+		q ^= (uint8_t)(q << 1);
+		q ^= (uint8_t)(q << 2);
+		q ^= (uint8_t)(q << 4);
+		if(q & 0x80)
+			q ^= 0x09;
+		uint8_t x = q ^ (uint8_t)(q << 1 | q >> 7) ^ (uint8_t)(q << 2 | q >> 6) ^
+			(uint8_t)(q << 3 | q >> 5) ^ (uint8_t)(q << 4 | q >> 4);
+		sbox[p] = x ^ 0x63;
+	} while(p != 1);
+	sbox[0] = 0x63;
+
+	for(int i = 0; i < 256; i++){
+		uint32_t s = sbox[i];
+		uint32_t twice = ((s << 1) ^ ((s & 0x80) ? 0x1B : 0)) & 0xFF;
+		uint32_t word = twice << 24 | s << 16 | s << 8 | (twice ^ s);
+		for(int t = 0; t < 4; t++){
+			te[t][i] = word;
+			word = word >> 8 | word << 24;
+		}
+	}
+
+#ifdef CIPHER_HAVE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3")){
+		aes_block = aes_block_ni;
+		ctr_update = ctr_ni;
+	}
+	if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+		ghash_update = ghash_clmul;
+#endif
+}
+
+/* AES-256 schedule, kept as bytes for the instructions and as words for the tables */
+void aes_expand(Cipher* cipher, const uint8_t key[CIPHER_KEY_SIZE]){
+	uint8_t* w = cipher->round_keys;
+	uint8_t rcon = 1;
+	memcpy(w, key, CIPHER_KEY_SIZE);
+	for(int i = 8; i < (CIPHER_ROUNDS + 1) * 4; i++){
+		uint8_t t[4];
+		memcpy(t, w + (i - 1) * 4, 4);
+		if(i % 8 == 0){
+			uint8_t first = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[first];
+			rcon = (uint8_t)(rcon << 1) ^ ((rcon & 0x80) ? 0x1B : 0);
+		}
+		else if(i % 8 == 4)
+			for(int j = 0; j < 4; j++)
+				t[j] = sbox[t[j]];
+		for(int j = 0; j < 4; j++)
+			w[i * 4 + j] = w[(i - 8) * 4 + j] ^ t[j];
+	}
+	for(int i = 0; i < (CIPHER_ROUNDS + 1) * 4; i++)
+		cipher->key_words[i] = get_be32(w + i * 4);
+}
+
+void aes_block_portable(const Cipher* cipher, const uint8_t input[16], uint8_t output[16]){
+	const uint32_t* k = cipher->key_words;
+	uint32_t s0 = get_be32(input) ^ k[0], s1 = get_be32(input + 4) ^ k[1];
+	uint32_t s2 = get_be32(input + 8) ^ k[2], s3 = get_be32(input + 12) ^ k[3];
+	for(int round = 1; round < CIPHER_ROUNDS; round++){
+		k += 4;
+		uint32_t t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xFF] ^ te[2][(s2 >> 8) & 0xFF] ^ te[3][s3 & 0xFF] ^ k[0];
+		uint32_t t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xFF] ^ te[2][(s3 >> 8) & 0xFF] ^ te[3][s0 & 0xFF] ^ k[1];
+		uint32_t t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xFF] ^ te[2][(s0 >> 8) & 0xFF] ^ te[3][s1 & 0xFF] ^ k[2];
+		uint32_t t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xFF] ^ te[2][(s1 >> 8) & 0xFF] ^ te[3][s2 & 0xFF] ^ k[3];
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+	k += 4;
+	uint32_t state[4] = {s0, s1, s2, s3};
+	for(int i = 0; i < 4; i++){
+		uint32_t word = (uint32_t)sbox[state[i] >> 24] << 24 |
+			(uint32_t)sbox[(state[(i + 1) & 3] >> 16) & 0xFF] << 16 |
+			(uint32_t)sbox[(state[(i + 2) & 3] >> 8) & 0xFF] << 8 |
+			sbox[state[(i + 3) & 3] & 0xFF];
+		put_be32(output + i * 4, word ^ k[i]);
+	}
+}
+
+void ctr_portable(const Cipher* cipher, uint8_t counter[16], const uint8_t* input, uint8_t* output,
+	size_t length){
+	uint8_t stream[16];
+	for(;length;){
+		aes_block_portable(cipher, counter, stream);
+		put_be32(counter + 12, get_be32(counter + 12) + 1);
+		size_t step = (length < 16) ? length : 16;
+		for(size_t i = 0; i < step; i++)
+			output[i] = input[i] ^ stream[i];
+		input += step;
+		output += step;
+		length -= step;
+	}
+}
+
+/* Multiples of the hash key by every 4-bit value, reflected order */
+void ghash_tables(Cipher* cipher){
+	uint64_t high = (uint64_t)get_be32(cipher->hash_key) << 32 | get_be32(cipher->hash_key + 4);
+	uint64_t low = (uint64_t)get_be32(cipher->hash_key + 8) << 32 | get_be32(cipher->hash_key + 12);
+	cipher->table_high[0] = cipher->table_low[0] = 0;
+	cipher->table_high[8] = high;
+	cipher->table_low[8] = low;
+	for(int i = 4; i > 0; i >>= 1){
+		uint32_t carry = (low & 1) ? 0xE1000000u : 0;
+		low = high << 63 | low >> 1;
+		high = high >> 1 ^ (uint64_t)carry << 32;
+		cipher->table_high[i] = high;
+		cipher->table_low[i] = low;
+	}
+	for(int i = 2; i <= 8; i *= 2)
+		for(int j = 1; j < i; j++){
+			cipher->table_high[i + j] = cipher->table_high[i] ^ cipher->table_high[j];
+			cipher->table_low[i + j] = cipher->table_low[i] ^ cipher->table_low[j];
+		}
+}
+
+/* Shoup's 4-bit method, a partial last block is zero padded */
+void ghash_portable(const Cipher* cipher, uint8_t state[16], const uint8_t* data, size_t length){
+	for(;length;){
+		size_t step = (length < 16) ? length : 16;
+		for(size_t i = 0; i < step; i++)
+			state[i] ^= data[i];
+		data += step;
+		length -= step;
+
+		uint64_t high = cipher->table_high[state[15] & 0xF], low = cipher->table_low[state[15] & 0xF];
+		for(int i = 15; i >= 0; i--){
+			int nibble = state[i] & 0xF;
+			if(i != 15){
+				int rest = low & 0xF;
+				low = high << 60 | low >> 4;
+				high = high >> 4 ^ (uint64_t)last4[rest] << 48 ^ cipher->table_high[nibble];
+				low ^= cipher->table_low[nibble];
+			}
+			nibble = state[i] >> 4;
+			int rest = low & 0xF;
+			low = high << 60 | low >> 4;
+			high = high >> 4 ^ (uint64_t)last4[rest] << 48 ^ cipher->table_high[nibble];
+			low ^= cipher->table_low[nibble];
+		}
+		put_be64(state, high);
+		put_be64(state + 8, low);
+	}
+}
+
+void gcm_counter(const uint8_t nonce[CIPHER_NONCE_SIZE], uint32_t block, uint8_t counter[16]){
+	memcpy(counter, nonce, CIPHER_NONCE_SIZE);
+	put_be32(counter + CIPHER_NONCE_SIZE, block);
+}
+
+/* Lengths block into the hash, then masked with the first counter block */
+void gcm_tag(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE], uint8_t state[16],
+	size_t aad_length, size_t length, uint8_t tag[16]){
+	uint8_t lengths[16], counter[16];
+	put_be64(lengths, (uint64_t)aad_length * 8);
+	put_be64(lengths + 8, (uint64_t)length * 8);
+	ghash_update(cipher, state, lengths, 16);
+	gcm_counter(nonce, 1, counter);
+	aes_block(cipher, counter, tag);
+	for(int i = 0; i < 16; i++)
+		tag[i] ^= state[i];
+}
+
+/* Hash states after the padded key blocks, every iteration resumes from them */
+void hmac_keys(Sha256* inner, Sha256* outer, const uint8_t* key, size_t length){
+	uint8_t block[SHA256_BLOCK] = {0};
+	if(length > SHA256_BLOCK)
+		sha256(key, length, block);
+	else
+		memcpy(block, key, length);
+	for(int i = 0; i < SHA256_BLOCK; i++)
+		block[i] ^= 0x36;
+	sha256_init(inner);
+	sha256_update(inner, block, SHA256_BLOCK);
+	for(int i = 0; i < SHA256_BLOCK; i++)
+		block[i] ^= 0x36 ^ 0x5C;
+	sha256_init(outer);
+	sha256_update(outer, block, SHA256_BLOCK);
+	memset(block, 0, sizeof(block));
+}
+
+void hmac_finish(const Sha256* inner, const Sha256* outer, const uint8_t* data, size_t length,
+	uint8_t digest[SHA256_SIZE]){
+	Sha256 ctx = *inner;
+	sha256_update(&ctx, data, length);
+	sha256_final(&ctx, digest);
+	ctx = *outer;
+	sha256_update(&ctx, digest, SHA256_SIZE);
+	sha256_final(&ctx, digest);
+}
+
+/* RFC 8018 key derivation with HMAC-SHA256 */
+void pbkdf2_sha256(const uint8_t* password, size_t password_length, const uint8_t* salt, size_t salt_length,
+	uint32_t iterations, uint8_t* output, size_t length){
+	Sha256 inner, outer;
+	hmac_keys(&inner, &outer, password, password_length);
+
+	for(uint32_t index = 1; length; index++){
+		uint8_t u[SHA256_SIZE], t[SHA256_SIZE], number[4];
+		Sha256 ctx = inner;
+		put_be32(number, index);
+		sha256_update(&ctx, salt, salt_length);
+		sha256_update(&ctx, number, 4);
+		sha256_final(&ctx, u);
+		ctx = outer;
+		sha256_update(&ctx, u, SHA256_SIZE);
+		sha256_final(&ctx, u);
+		memcpy(t, u, SHA256_SIZE);
+		for(uint32_t i = 1; i < iterations; i++){
+			hmac_finish(&inner, &outer, u, SHA256_SIZE, u);
+			for(int j = 0; j < SHA256_SIZE; j++)
+				t[j] ^= u[j];
+		}
+		size_t step = (length < SHA256_SIZE) ? length : SHA256_SIZE;
+		memcpy(output, t, step);
+		output += step;
+		length -= step;
+		memset(u, 0, sizeof(u));
+		memset(t, 0, sizeof(t));
+	}
+	memset(&inner, 0, sizeof(inner));
+	memset(&outer, 0, sizeof(outer));
+}
+
+/* Kernel randomness, the device when the call is missing */
+int cipher_random(uint8_t* output, size_t length){
+	for(;length;){
+		long got = syscall(SYS_getrandom, output, length, 0);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			break;
+		output += got;
+		length -= (size_t)got;
+	}
+	if(!length)
+		return 0;
+
+	int fd = open("/dev/urandom", O_RDONLY);
+	if(fd < 0)
+		return -1;
+	for(;length;){
+		ssize_t got = read(fd, output, length);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0){
+			close(fd);
+			return -1;
+		}
+		output += got;
+		length -= (size_t)got;
+	}
+	close(fd);
+	return 0;
+}
+
+/* Archive key from the password, check bytes let extract refuse a wrong one early */
+int cipher_init(Cipher* cipher, const char* password, const uint8_t* salt, uint32_t iterations,
+	uint8_t check[CIPHER_CHECK_SIZE]){
+	uint8_t key[CIPHER_KEY_SIZE], digest[SHA256_SIZE], zero[16] = {0};
+	pthread_once(&cipher_once, cipher_setup);
+	memset(cipher, 0, sizeof(Cipher));
+	if(cipher_random(cipher->prefix, CIPHER_NONCE_SIZE) != 0)
+		return -1;
+
+	pbkdf2_sha256((const uint8_t*)password, strlen(password), salt, CIPHER_SALT_SIZE, iterations,
+		key, CIPHER_KEY_SIZE);
+	aes_expand(cipher, key);
+	aes_block(cipher, zero, cipher->hash_key);
+	ghash_tables(cipher);
+	sha256(key, CIPHER_KEY_SIZE, digest);
+	memcpy(check, digest, CIPHER_CHECK_SIZE);
+	memset(key, 0, sizeof(key));
+	return 0;
+}
+
+/* Next nonce of the run, unique as long as the counter doesn't wrap */
+void cipher_nonce(Cipher* cipher, uint8_t nonce[CIPHER_NONCE_SIZE]){
+	uint64_t sequence = __atomic_fetch_add(&cipher->counter, 1, __ATOMIC_RELAXED);
+	memcpy(nonce, cipher->prefix, CIPHER_NONCE_SIZE);
+	for(int i = 0; i < 8; i++)
+		nonce[CIPHER_NONCE_SIZE - 8 + i] ^= (uint8_t)(sequence >> (i * 8));
+}
+
+/* Encrypt in place, the tag covers aad and ciphertext */
+void cipher_seal(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE], const uint8_t* aad, size_t aad_length,
+	uint8_t* data, size_t length, uint8_t tag[CIPHER_TAG_SIZE]){
+	uint8_t counter[16], state[16] = {0};
+	ghash_update(cipher, state, aad, aad_length);
+	gcm_counter(nonce, 2, counter);
+	for(size_t done = 0; done < length;){
+		size_t step = (length - done < GCM_CHUNK) ? length - done : GCM_CHUNK;
+		ctr_update(cipher, counter, data + done, data + done, step);
+		ghash_update(cipher, state, data + done, step);
+		done += step;
+	}
+	gcm_tag(cipher, nonce, state, aad_length, length, tag);
+}
+
+/* Decrypt input into output, which may be the same buffer,
+ * output is wiped when the tag does not match */
+int cipher_open(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE], const uint8_t* aad, size_t aad_length,
+	const uint8_t* input, uint8_t* output, size_t length, const uint8_t tag[CIPHER_TAG_SIZE]){
+	uint8_t counter[16], state[16] = {0}, expected[16];
+	ghash_update(cipher, state, aad, aad_length);
+	gcm_counter(nonce, 2, counter);
+	for(size_t done = 0; done < length;){
+		size_t step = (length - done < GCM_CHUNK) ? length - done : GCM_CHUNK;
+		ghash_update(cipher, state, input + done, step);
+		ctr_update(cipher, counter, input + done, output + done, step);
+		done += step;
+	}
+	gcm_tag(cipher, nonce, state, aad_length, length, expected);
+
+	uint8_t difference = 0;
+	for(int i = 0; i < CIPHER_TAG_SIZE; i++)
+		difference |= expected[i] ^ tag[i];
+	if(difference){
+		memset(output, 0, length);
+		return -1;
+	}
+	return 0;
+}
+
+/* Keystream word from the block GCM never uses for data, hides a checksum */
+uint32_t cipher_mask(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE]){
+	uint8_t counter[16], stream[16];
+	if(!cipher)
+		return 0;
+	gcm_counter(nonce, 0, counter);
+	aes_block(cipher, counter, stream);
+	return get_le32(stream);
+}
+
+/* Mask of a member checksum, bound to the member name */
+uint32_t cipher_mask_name(const Cipher* cipher, const char* name){
+	uint8_t digest[SHA256_SIZE];
+	if(!cipher)
+		return 0;
+	sha256((const uint8_t*)name, strlen(name), digest);
+	return cipher_mask(cipher, digest);
+}
@@ -0,0 +1,58 @@
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/syscall.h>
+
+#include "lib.h"
+#include "sha256.h"
+
+/* defines */
+#define CIPHER_AES256_GCM 1
+#define CIPHER_KEY_SIZE 32
+#define CIPHER_NONCE_SIZE 12
+#define CIPHER_TAG_SIZE 16
+#define CIPHER_OVERHEAD (CIPHER_NONCE_SIZE + CIPHER_TAG_SIZE)  /* added to every encrypted record */
+#define CIPHER_SALT_SIZE 16
+#define CIPHER_CHECK_SIZE 8       /* tells a wrong password from a damaged archive */
+#define CIPHER_ITERATIONS 600000  /* PBKDF2-SHA256 rounds of new archives */
+#define CIPHER_ITERATIONS_MAX 100000000
+#define CIPHER_ROUNDS 14
+
+/* AES-256-GCM key of one archive, shared read-only by all threads
+ * except for the nonce counter */
+typedef struct {
+	uint8_t round_keys[(CIPHER_ROUNDS + 1) * 16];  /* byte order, as AES-NI loads them */
+	uint32_t key_words[(CIPHER_ROUNDS + 1) * 4];   /* big-endian words of the table path */
+	uint8_t hash_key[16];     /* GHASH key, E(0) */
+	uint64_t table_high[16];  /* 4-bit GHASH tables of the software path */
+	uint64_t table_low[16];
+	uint8_t prefix[CIPHER_NONCE_SIZE];  /* random per run, nonces are it xor a counter */
+	uint64_t counter;
+} Cipher;
+
+/* Function declarations */
+void pbkdf2_sha256(const uint8_t* password, size_t password_length, const uint8_t* salt, size_t salt_length,
+	uint32_t iterations, uint8_t* output, size_t length);
+int cipher_random(uint8_t* output, size_t length);
+int cipher_init(Cipher* cipher, const char* password, const uint8_t* salt, uint32_t iterations,
+	uint8_t check[CIPHER_CHECK_SIZE]);
+void cipher_nonce(Cipher* cipher, uint8_t nonce[CIPHER_NONCE_SIZE]);
+void cipher_seal(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE], const uint8_t* aad, size_t aad_length,
+	uint8_t* data, size_t length, uint8_t tag[CIPHER_TAG_SIZE]);
+int cipher_open(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE], const uint8_t* aad, size_t aad_length,
+	const uint8_t* input, uint8_t* output, size_t length, const uint8_t tag[CIPHER_TAG_SIZE]);
+uint32_t cipher_mask(const Cipher* cipher, const uint8_t nonce[CIPHER_NONCE_SIZE]);
+uint32_t cipher_mask_name(const Cipher* cipher, const char* name);
+
+#endif
@@ -0,0 +1,159 @@
+#include "dedup.h"
+
+static uint64_t dedup_bucket(const DedupTable* table, uint8_t kind, const uint8_t* digest);
+static int dedup_grow(DedupTable* table);
+
+int dedup_init(DedupTable* table){
+	memset(table, 0, sizeof(DedupTable));
+	table->buckets = malloc(DEDUP_BUCKETS * sizeof(int64_t));
+	if(!table->buckets)
+		return -1;
+	memset(table->buckets, 0xFF, DEDUP_BUCKETS * sizeof(int64_t));
+	table->bucket_count = DEDUP_BUCKETS;
+	pthread_mutex_init(&table->lock, NULL);
+	return 0;
+}
+
+void dedup_free(DedupTable* table){
+	if(!table->buckets)
+		return;
+	pthread_mutex_destroy(&table->lock);
+	free(table->entries);
+	free(table->buckets);
+	memset(table, 0, sizeof(DedupTable));
+}
+
+/* Digests are already uniform, their first bytes pick the bucket */
+uint64_t dedup_bucket(const DedupTable* table, uint8_t kind, const uint8_t* digest){
+	uint64_t hash = kind;
+	for(int i = 0; i < 8; i++)
+		hash = (hash << 8) | digest[i];
+	return hash & (table->bucket_count - 1);
+}
+
+/* Double entries and buckets, chains are rebuilt oldest first
+ * so every bucket still starts with its newest entry */
+int dedup_grow(DedupTable* table){
+	uint64_t capacity = table->capacity ? table->capacity * 2 : DEDUP_BUCKETS;
+	DedupEntry* entries = realloc(table->entries, capacity * sizeof(DedupEntry));
+	if(!entries)
+		return -1;
+	table->entries = entries;
+	table->capacity = capacity;
+
+	if(capacity <= table->bucket_count)
+		return 0;
+	int64_t* buckets = realloc(table->buckets, capacity * sizeof(int64_t));
+	if(!buckets)
+		return -1;
+	memset(buckets, 0xFF, capacity * sizeof(int64_t));
+	table->buckets = buckets;
+	table->bucket_count = capacity;
+	for(uint64_t i = 0; i < table->count; i++){
+		uint64_t bucket = dedup_bucket(table, entries[i].kind, entries[i].digest);
+		entries[i].next = buckets[bucket];
+		buckets[bucket] = (int64_t)i;
+	}
+	return 0;
+}
+
+/* 1 and the entry when the content was seen before */
+int dedup_find(DedupTable* table, uint8_t kind, const uint8_t* digest, DedupEntry* found){
+	int hit = 0;
+	pthread_mutex_lock(&table->lock);
+	for(int64_t i = table->buckets[dedup_bucket(table, kind, digest)]; i >= 0; i = table->entries[i].next)
+		if(table->entries[i].kind == kind && memcmp(table->entries[i].digest, digest, SHA256_SIZE) == 0){
+			if(found)
+				*found = table->entries[i];
+			hit = 1;
+			break;
+		}
+	pthread_mutex_unlock(&table->lock);
+	return hit;
+}
+
+int dedup_add(DedupTable* table, uint8_t kind, const uint8_t* digest, uint64_t offset, uint64_t extra,
+	uint32_t checksum){
+	int status = 0;
+	pthread_mutex_lock(&table->lock);
+	/* A full table keeps what it has, later content is simply not found */
+	if(table->count == table->capacity && (table->count >= DEDUP_MAX_ENTRIES || dedup_grow(table) != 0))
+		status = (table->count >= DEDUP_MAX_ENTRIES) ? 0 : -1;
+	else {
+		DedupEntry* entry = &table->entries[table->count];
+		uint64_t bucket = dedup_bucket(table, kind, digest);
+		memcpy(entry->digest, digest, SHA256_SIZE);
+		entry->offset = offset;
+		entry->extra = extra;
+		entry->checksum = checksum;
+		entry->kind = kind;
+		entry->next = table->buckets[bucket];
+		table->buckets[bucket] = (int64_t)table->count++;
+	}
+	pthread_mutex_unlock(&table->lock);
+	return status;
+}
+
+uint64_t dedup_mark(DedupTable* table){
+	pthread_mutex_lock(&table->lock);
+	uint64_t mark = table->count;
+	pthread_mutex_unlock(&table->lock);
+	return mark;
+}
+
+/* Forget entries added after mark, newest first, for a member
+ * whose bytes are about to be overwritten */
+void dedup_rollback(DedupTable* table, uint64_t mark){
+	pthread_mutex_lock(&table->lock);
+	for(;table->count > mark;){
+		DedupEntry* entry = &table->entries[--table->count];
+		table->buckets[dedup_bucket(table, entry->kind, entry->digest)] = entry->next;
+	}
+	pthread_mutex_unlock(&table->lock);
+}
+
+/* Member identity: size, then the digest of every block in order,
+ * so block jobs hashed on different threads give the same answer */
+void member_digest_init(Sha256* ctx, uint64_t size){
+	uint8_t field[8];
+	for(int i = 0; i < 8; i++)
+		field[i] = (size >> (8 * i)) & 0xFF;
+	sha256_init(ctx);
+	sha256_update(ctx, field, sizeof(field));
+}
+
+void member_digest(const uint8_t* data, uint64_t size, uint64_t block_size, uint8_t digest[SHA256_SIZE]){
+	Sha256 ctx;
+	uint8_t block_digest[SHA256_SIZE];
+	member_digest_init(&ctx, size);
+	for(uint64_t done = 0; done < size; done += block_size){
+		size_t length = (size - done < block_size) ? (size_t)(size - done) : (size_t)block_size;
+		sha256(data + done, length, block_digest);
+		sha256_update(&ctx, block_digest, SHA256_SIZE);
+	}
+	sha256_final(&ctx, digest);
+}
+
+/* Same digest read with pread, for files that are not mapped */
+int file_digest(int fd, uint64_t size, uint64_t block_size, uint8_t digest[SHA256_SIZE]){
+	uint8_t* block = malloc((size_t)block_size);
+	if(!block)
+		return -1;
+
+	Sha256 ctx;
+	uint8_t block_digest[SHA256_SIZE];
+	member_digest_init(&ctx, size);
+	int status = 0;
+	for(uint64_t done = 0; done < size && status == 0; done += block_size){
+		size_t length = (size - done < block_size) ? (size_t)(size - done) : (size_t)block_size;
+		if(pread(fd, block, length, (off_t)done) != (ssize_t)length)
+			status = -1;
+		else {
+			sha256(block, length, block_digest);
+			sha256_update(&ctx, block_digest, SHA256_SIZE);
+		}
+	}
+	sha256_final(&ctx, digest);
+	free(block);
+	return status;
+}
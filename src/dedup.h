@@ -0,0 +1,52 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sha256.h"
+
+/* defines */
+#define DEDUP_FILE 0              /* whole member, offset of its FileHeader */
+#define DEDUP_BLOCK 1             /* block record, offset of its record header */
+#define DEDUP_BUCKETS 4096        /* initial hash buckets, grows with the table */
+#define DEDUP_MAX_ENTRIES (1 << 20)   /* later content is not looked up, keeps memory flat */
+
+/* Content seen earlier in this archive */
+typedef struct {
+	uint8_t digest[SHA256_SIZE];
+	uint64_t offset;
+	uint64_t extra;           /* original size, or order and mem_shift of a block */
+	uint32_t checksum;        /* CRC32C of a whole member */
+	int64_t next;             /* older entry in the same bucket */
+	uint8_t kind;
+} DedupEntry;
+
+/* Digest index shared by the writer (adds) and workers (lookups) */
+typedef struct {
+	DedupEntry* entries;
+	uint64_t count;
+	uint64_t capacity;
+	int64_t* buckets;
+	uint64_t bucket_count;
+	pthread_mutex_t lock;
+} DedupTable;
+
+/* Function declarations */
+int dedup_init(DedupTable* table);
+void dedup_free(DedupTable* table);
+int dedup_find(DedupTable* table, uint8_t kind, const uint8_t* digest, DedupEntry* found);
+int dedup_add(DedupTable* table, uint8_t kind, const uint8_t* digest, uint64_t offset, uint64_t extra,
+	uint32_t checksum);
+uint64_t dedup_mark(DedupTable* table);
+void dedup_rollback(DedupTable* table, uint64_t mark);
+void member_digest_init(Sha256* ctx, uint64_t size);
+void member_digest(const uint8_t* data, uint64_t size, uint64_t block_size, uint8_t digest[SHA256_SIZE]);
+int file_digest(int fd, uint64_t size, uint64_t block_size, uint8_t digest[SHA256_SIZE]);
+
+#endif
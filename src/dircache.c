@@ -0,0 +1,135 @@
+#include "dircache.h"
+
+static uint64_t dircache_hash(const char* path);
+static size_t dircache_slot(const DirCache* cache, const char* path, uint64_t hash);
+static int dircache_known(DirCache* cache, const char* path);
+static int dircache_add(DirCache* cache, const char* path);
+static int dircache_grow(DirCache* cache);
+
+int dircache_init(DirCache* cache){
+	memset(cache, 0, sizeof(DirCache));
+	cache->slots = calloc(DIRCACHE_SLOTS, sizeof(char*));
+	cache->hashes = calloc(DIRCACHE_SLOTS, sizeof(uint64_t));
+	if(!cache->slots || !cache->hashes){
+		free(cache->slots);
+		free(cache->hashes);
+		return -1;
+	}
+	cache->capacity = DIRCACHE_SLOTS;
+	pthread_mutex_init(&cache->lock, NULL);
+	return 0;
+}
+
+void dircache_free(DirCache* cache){
+	if(!cache->slots)
+		return;
+	for(size_t i = 0; i < cache->capacity; i++)
+		free(cache->slots[i]);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->slots);
+	free(cache->hashes);
+	memset(cache, 0, sizeof(DirCache));
+}
+
+/* FNV-1a */
+uint64_t dircache_hash(const char* path){
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for(;*path; path++)
+		hash = (hash ^ (uint8_t)*path) * 0x100000001B3ull;
+	return hash;
+}
+
+/* Slot holding path, or the free slot it would go to */
+size_t dircache_slot(const DirCache* cache, const char* path, uint64_t hash){
+	size_t mask = cache->capacity - 1;
+	size_t i = (size_t)hash & mask;
+	for(;cache->slots[i] && (cache->hashes[i] != hash || strcmp(cache->slots[i], path) != 0); i = (i + 1) & mask);
+	return i;
+}
+
+int dircache_known(DirCache* cache, const char* path){
+	pthread_mutex_lock(&cache->lock);
+	int known = cache->slots[dircache_slot(cache, path, dircache_hash(path))] != NULL;
+	pthread_mutex_unlock(&cache->lock);
+	return known;
+}
+
+/* A failed insert only costs a repeated mkdir later */
+int dircache_add(DirCache* cache, const char* path){
+	uint64_t hash = dircache_hash(path);
+	int status = 0;
+	pthread_mutex_lock(&cache->lock);
+	size_t i = dircache_slot(cache, path, hash);
+	if(!cache->slots[i]){
+		if((cache->count + 1) * 2 > cache->capacity && dircache_grow(cache) == 0)
+			i = dircache_slot(cache, path, hash);
+		if((cache->count + 1) * 2 > cache->capacity || !(cache->slots[i] = strdup(path)))
+			status = -1;
+		else {
+			cache->hashes[i] = hash;
+			cache->count++;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return status;
+}
+
+int dircache_grow(DirCache* cache){
+	size_t capacity = cache->capacity * 2;
+	char** slots = calloc(capacity, sizeof(char*));
+	uint64_t* hashes = calloc(capacity, sizeof(uint64_t));
+	if(!slots || !hashes){
+		free(slots);
+		free(hashes);
+		return -1;
+	}
+
+	for(size_t i = 0; i < cache->capacity; i++){
+		if(!cache->slots[i])
+			continue;
+		size_t j = (size_t)cache->hashes[i] & (capacity - 1);
+		for(;slots[j]; j = (j + 1) & (capacity - 1));
+		slots[j] = cache->slots[i];
+		hashes[j] = cache->hashes[i];
+	}
+	free(cache->slots);
+	free(cache->hashes);
+	cache->slots = slots;
+	cache->hashes = hashes;
+	cache->capacity = capacity;
+	return 0;
+}
+
+/* mkdir -p for the directory holding filepath. A known parent costs one
+ * lookup, otherwise every missing level is created once and remembered */
+int dircache_parents(DirCache* cache, const char* filepath){
+	char path[PATH_MAX + BUFFER*2];
+	size_t length = strlen(filepath);
+	if(length >= sizeof(path))
+		return -1;
+	memcpy(path, filepath, length + 1);
+
+	char* slash = strrchr(path, '/');
+	if(!slash || slash == path)
+		return 0;
+	*slash = '\0';
+	if(dircache_known(cache, path))
+		return 0;
+	*slash = '/';
+
+	/* Levels in order, the leading / of an absolute path is skipped */
+	for(char* at = strchr(path + 1, '/'); at && at <= slash; at = strchr(at + 1, '/')){
+		*at = '\0';
+		if(!dircache_known(cache, path)){
+			struct stat st;
+			if(mkdir(path, 0755) != 0 && (errno != EEXIST || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))){
+				if(errno == EEXIST)
+					errno = ENOTDIR;
+				return -1;
+			}
+			dircache_add(cache, path);
+		}
+		*at = '/';
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "lib.h"
+
+/* defines */
+#define DIRCACHE_SLOTS 1024       /* initial slots, doubled at half load */
+
+/* Directories created or found during one extraction, shared by its workers */
+typedef struct {
+	char** slots;             /* open addressing, NULL when free */
+	uint64_t* hashes;
+	size_t capacity;
+	size_t count;
+	pthread_mutex_t lock;
+} DirCache;
+
+/* Function declarations */
+int dircache_init(DirCache* cache);
+void dircache_free(DirCache* cache);
+int dircache_parents(DirCache* cache, const char* filepath);
+
+#endif
@@ -0,0 +1,116 @@
+#include "codec.h"
+
+static void sample_gather(const uint8_t* data, uint64_t size, EntropySample* sample);
+static void sample_scan(EntropySample* sample);
+static uint64_t sample_offset(uint64_t size, int window);
+static int sample_verdict(const EntropySample* sample, int hint);
+
+/* Histogram the gathered windows, four interleaved tables keep
+ * neighbouring increments from stalling on the same counter */
+void sample_scan(EntropySample* sample){
+	const uint8_t* data = sample->data;
+	size_t length = sample->total;
+	size_t i = 0;
+	for(;i + 4 <= length; i += 4){
+		sample->counts[0][data[i]]++;
+		sample->counts[1][data[i + 1]]++;
+		sample->counts[2][data[i + 2]]++;
+		sample->counts[3][data[i + 3]]++;
+	}
+	for(;i < length; i++)
+		sample->counts[0][data[i]]++;
+
+	/* Repeated 4-byte strings, also across windows, give away
+	 * structure a flat histogram hides */
+	uint16_t last[SAMPLE_HASH_SIZE];
+	memset(last, 0xFF, sizeof(last));
+	for(i = 0; i + 4 <= length; i++){
+		uint32_t word = (uint32_t)data[i] | (uint32_t)data[i + 1] << 8 |
+			(uint32_t)data[i + 2] << 16 | (uint32_t)data[i + 3] << 24;
+		uint32_t slot = (word * 2654435761u) >> (32 - SAMPLE_HASH_BITS);
+		if(last[slot] != 0xFFFF && memcmp(data + last[slot], data + i, 4) == 0)
+			sample->repeats++;
+		last[slot] = (uint16_t)i;
+	}
+}
+
+/* Windows spread evenly from the first to the last byte */
+uint64_t sample_offset(uint64_t size, int window){
+	if(size <= (uint64_t)SAMPLE_WINDOWS * SAMPLE_WINDOW_SIZE)
+		return (uint64_t)window * SAMPLE_WINDOW_SIZE;
+	return (size - SAMPLE_WINDOW_SIZE) * (uint64_t)window / (SAMPLE_WINDOWS - 1);
+}
+
+/* Order-0 entropy in bits per byte against the store threshold,
+ * names the extension list flags must show clear redundancy */
+int sample_verdict(const EntropySample* sample, int hint){
+	if(sample->total < SAMPLE_MIN_SIZE)
+		return 1;
+	if(sample->repeats * SAMPLE_REPEAT_RATIO > sample->total)
+		return 1;
+
+	double entropy = 0.0;
+	for(int symbol = 0; symbol < 256; symbol++){
+		uint64_t count = (uint64_t)sample->counts[0][symbol] + sample->counts[1][symbol] +
+			sample->counts[2][symbol] + sample->counts[3][symbol];
+		if(count){
+			double p = (double)count / (double)sample->total;
+			entropy -= p * log2(p);
+		}
+	}
+	return entropy < (hint ? ENTROPY_STORE : ENTROPY_HINT_STORE);
+}
+
+/* Copy the windows out of memory or a mapping */
+void sample_gather(const uint8_t* data, uint64_t size, EntropySample* sample){
+	memset(sample, 0, sizeof(EntropySample));
+	for(int i = 0; i < SAMPLE_WINDOWS; i++){
+		uint64_t offset = sample_offset(size, i);
+		if(offset >= size)
+			break;
+		size_t length = (size - offset < SAMPLE_WINDOW_SIZE) ? (size_t)(size - offset) : SAMPLE_WINDOW_SIZE;
+		memcpy(sample->data + sample->total, data + offset, length);
+		sample->total += length;
+	}
+}
+
+/* Estimate from memory or a mapping, 0 means store it */
+int data_compressible(const uint8_t* data, uint64_t size, int hint){
+	EntropySample sample;
+	sample_gather(data, size, &sample);
+	sample_scan(&sample);
+	return sample_verdict(&sample, hint);
+}
+
+/* Trial of one block: noise is stored, and a sample the run coder
+ * leaves almost nothing of gains too little from a model to pay for it */
+int block_class(const uint8_t* data, uint64_t size){
+	EntropySample sample;
+	sample_gather(data, size, &sample);
+	sample_scan(&sample);
+	if(!sample_verdict(&sample, 1))
+		return BLOCK_CLASS_STORE;
+	if(sample.total < SAMPLE_MIN_SIZE)
+		return BLOCK_CLASS_CODE;
+
+	uint8_t trial[SAMPLE_WINDOWS * SAMPLE_WINDOW_SIZE / BLOCK_RUNS_RATIO];
+	size_t coded = fast_encode(sample.data, (size_t)sample.total, trial, (size_t)sample.total / BLOCK_RUNS_RATIO);
+	return coded ? BLOCK_CLASS_RUNS : BLOCK_CLASS_CODE;
+}
+
+/* Same windows read with pread, for files not yet in memory */
+int file_compressible(int fd, uint64_t size, int hint){
+	EntropySample sample;
+	memset(&sample, 0, sizeof(EntropySample));
+	for(int i = 0; i < SAMPLE_WINDOWS; i++){
+		uint64_t offset = sample_offset(size, i);
+		if(offset >= size)
+			break;
+		size_t length = (size - offset < SAMPLE_WINDOW_SIZE) ? (size_t)(size - offset) : SAMPLE_WINDOW_SIZE;
+		if(pread(fd, sample.data + sample.total, length, (off_t)offset) != (ssize_t)length)
+			return 1;
+		sample.total += length;
+	}
+	sample_scan(&sample);
+	return sample_verdict(&sample, hint);
+}
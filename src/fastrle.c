@@ -0,0 +1,212 @@
+#include "fastrle.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAST_HAVE_X86 1
+#endif
+
+static void fast_setup(void);
+static uint32_t run_starts(uint32_t pairs);
+static size_t find_run_portable(const uint8_t* data, size_t length);
+static size_t run_length_portable(const uint8_t* data, size_t length);
+static int put_token(uint8_t flag, size_t count, uint8_t* output, size_t capacity, size_t* out);
+static int put_literals(const uint8_t* data, size_t count, uint8_t* output, size_t capacity, size_t* out);
+
+static size_t (*find_run)(const uint8_t* data, size_t length) = find_run_portable;
+static size_t (*run_length)(const uint8_t* data, size_t length) = run_length_portable;
+static pthread_once_t fast_once = PTHREAD_ONCE_INIT;
+
+/* Bit j of pairs says byte j equals byte j + 1, keep the bits
+ * that start FAST_MIN_RUN - 1 equal neighbours in a row */
+uint32_t run_starts(uint32_t pairs){
+	for(int covered = 1; covered < FAST_MIN_RUN - 1;){
+		int shift = (covered < FAST_MIN_RUN - 1 - covered) ? covered : FAST_MIN_RUN - 1 - covered;
+		pairs &= pairs >> shift;
+		covered += shift;
+	}
+	return pairs;
+}
+
+/* Offset of the first run of at least FAST_MIN_RUN bytes, length if none */
+size_t find_run_portable(const uint8_t* data, size_t length){
+	size_t streak = 1;
+	for(size_t i = 1; i < length; i++){
+		streak = (data[i] == data[i - 1]) ? streak + 1 : 1;
+		if(streak == FAST_MIN_RUN)
+			return i + 1 - FAST_MIN_RUN;
+	}
+	return length;
+}
+
+/* Bytes equal to the first one */
+size_t run_length_portable(const uint8_t* data, size_t length){
+	size_t i = 1;
+	for(;i < length && data[i] == data[0]; i++);
+	return i;
+}
+
+#ifdef FAST_HAVE_X86
+static size_t find_run_sse2(const uint8_t* data, size_t length);
+static size_t run_length_sse2(const uint8_t* data, size_t length);
+static size_t find_run_avx2(const uint8_t* data, size_t length);
+static size_t run_length_avx2(const uint8_t* data, size_t length);
+
+/* 32 neighbour compares per step, a window without a hit
+ * rules out every run starting in its first 26 bytes */
+__attribute__((target("sse2")))
+size_t find_run_sse2(const uint8_t* data, size_t length){
+	size_t i = 0;
+	for(;i + 33 <= length; i += 32 - (FAST_MIN_RUN - 2)){
+		__m128i low = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)),
+			_mm_loadu_si128((const __m128i*)(data + i + 1)));
+		__m128i high = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 16)),
+			_mm_loadu_si128((const __m128i*)(data + i + 17)));
+		uint32_t starts = run_starts((uint32_t)_mm_movemask_epi8(low) | (uint32_t)_mm_movemask_epi8(high) << 16);
+		if(starts)
+			return i + (size_t)__builtin_ctz(starts);
+	}
+	return i + find_run_portable(data + i, length - i);
+}
+
+__attribute__((target("sse2")))
+size_t run_length_sse2(const uint8_t* data, size_t length){
+	__m128i value = _mm_set1_epi8((char)data[0]);
+	size_t i = 0;
+	for(;i + 16 <= length; i += 16){
+		uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), value));
+		if(equal != 0xFFFF)
+			return i + (size_t)__builtin_ctz(~equal);
+	}
+	for(;i < length && data[i] == data[0]; i++);
+	return i;
+}
+
+__attribute__((target("avx2")))
+size_t find_run_avx2(const uint8_t* data, size_t length){
+	size_t i = 0;
+	for(;i + 33 <= length; i += 32 - (FAST_MIN_RUN - 2)){
+		__m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)),
+			_mm256_loadu_si256((const __m256i*)(data + i + 1)));
+		uint32_t starts = run_starts((uint32_t)_mm256_movemask_epi8(equal));
+		if(starts)
+			return i + (size_t)__builtin_ctz(starts);
+	}
+	return i + find_run_portable(data + i, length - i);
+}
+
+__attribute__((target("avx2")))
+size_t run_length_avx2(const uint8_t* data, size_t length){
+	__m256i value = _mm256_set1_epi8((char)data[0]);
+	size_t i = 0;
+	for(;i + 32 <= length; i += 32){
+		uint32_t equal = (uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), value));
+		if(equal != 0xFFFFFFFFu)
+			return i + (size_t)__builtin_ctz(~equal);
+	}
+	for(;i < length && data[i] == data[0]; i++);
+	return i;
+}
+#endif
+
+/* Widest kernels the CPU runs */
+void fast_setup(void){
+#ifdef FAST_HAVE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		find_run = find_run_avx2;
+		run_length = run_length_avx2;
+	} else if(__builtin_cpu_supports("sse2")){
+		find_run = find_run_sse2;
+		run_length = run_length_sse2;
+	}
+#endif
+}
+
+int put_token(uint8_t flag, size_t count, uint8_t* output, size_t capacity, size_t* out){
+	if(*out >= capacity)
+		return -1;
+	if(count < FAST_COUNT_MASK){
+		output[(*out)++] = flag | (uint8_t)count;
+		return 0;
+	}
+
+	output[(*out)++] = flag | FAST_COUNT_MASK;
+	count -= FAST_COUNT_MASK;
+	for(;;){
+		if(*out >= capacity)
+			return -1;
+		output[(*out)++] = (uint8_t)(count & 0x7F) | (count > 0x7F ? 0x80 : 0);
+		count >>= 7;
+		if(!count)
+			return 0;
+	}
+}
+
+int put_literals(const uint8_t* data, size_t count, uint8_t* output, size_t capacity, size_t* out){
+	if(count == 0)
+		return 0;
+	if(put_token(0, count - 1, output, capacity, out) != 0 || count > capacity - *out)
+		return -1;
+	memcpy(output + *out, data, count);
+	*out += count;
+	return 0;
+}
+
+/* Runs and literals, 0 when the result would not fit in capacity */
+size_t fast_encode(const uint8_t* input, size_t size, uint8_t* output, size_t capacity){
+	pthread_once(&fast_once, fast_setup);
+
+	size_t out = 0, literal = 0;
+	for(size_t i = 0; i < size;){
+		size_t start = i + find_run(input + i, size - i);
+		if(start >= size)
+			break;
+
+		size_t run = run_length(input + start, size - start);
+		if(put_literals(input + literal, start - literal, output, capacity, &out) != 0 ||
+			put_token(FAST_RUN_FLAG, run - FAST_MIN_RUN, output, capacity, &out) != 0 || out >= capacity)
+			return 0;
+		output[out++] = input[start];
+		i = literal = start + run;
+	}
+	return (put_literals(input + literal, size - literal, output, capacity, &out) == 0) ? out : 0;
+}
+
+/* Expand a block body into exactly size bytes */
+int fast_decode(const uint8_t* input, size_t length, uint8_t* output, size_t size){
+	size_t in = 0, out = 0;
+	for(;in < length;){
+		uint8_t token = input[in++];
+		size_t count = token & FAST_COUNT_MASK;
+		if(count == FAST_COUNT_MASK){
+			size_t extra = 0;
+			int shift = 0;
+			uint8_t byte = 0x80;
+			for(;(byte & 0x80) && shift < 35; shift += 7){
+				if(in >= length)
+					return -1;
+				byte = input[in++];
+				extra |= (size_t)(byte & 0x7F) << shift;
+			}
+			if(byte & 0x80)
+				return -1;
+			count += extra;
+		}
+
+		if(token & FAST_RUN_FLAG){
+			count += FAST_MIN_RUN;
+			if(in >= length || count > size - out)
+				return -1;
+			memset(output + out, input[in++], count);
+		} else {
+			count += 1;
+			if(count > length - in || count > size - out)
+				return -1;
+			memcpy(output + out, input + in, count);
+			in += count;
+		}
+		out += count;
+	}
+	return (out == size) ? 0 : -1;
+}
@@ -0,0 +1,23 @@
+#ifndef FASTRLE_H
+#define FASTRLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <pthread.h>
+
+/* defines */
+#define FAST_MIN_RUN 8            /* shorter runs stay in the literals */
+#define FAST_RUN_FLAG 0x80        /* token is a run, value byte follows */
+#define FAST_COUNT_MASK 0x7F      /* count in the token, all ones means more follows */
+
+/* Block body of the fast level: tokens of
+ * {0, count - 1, literals...} or {1, count - FAST_MIN_RUN, value},
+ * counts that don't fit the token continue as a LEB128 varint */
+
+/* Function declarations */
+size_t fast_encode(const uint8_t* input, size_t size, uint8_t* output, size_t capacity);
+int fast_decode(const uint8_t* input, size_t length, uint8_t* output, size_t size);
+
+#endif
@@ -0,0 +1,177 @@
+#include "archive.h"
+
+/* On-disk headers. Legacy archives hold the raw structs, an 8 KB FileHeader
+ * before every member. Packed archives spell every field out in little-endian:
+ *   archive  magic[8], u32 format, u32 flags, u64 file count, u64 total size
+ *   member   u8 compressed, u8 algorithm, u32 mode, u64 payload size,
+ *            varint name length, name
+ * The payload size has a fixed width so the writer can patch it in place
+ * once a streamed member is done.
+ * Password archives (ARCHIVE_FLAG_PASSWORD) follow the archive header with
+ *   cipher   salt[16], u32 PBKDF2 rounds, u8 cipher, reserved[3], key check[8]
+ * and hold framed members only, every record sealed on its own. Names and
+ * sizes stay readable, member checksums are masked with the key.
+ * Archives written to a pipe (ARCHIVE_FLAG_STREAM) are never patched: the
+ * header counts nothing, framed members carry STREAM_SIZE_UNKNOWN, every
+ * payload is followed by the CRC32C of its content, and a STREAM_END byte
+ * stands between the last member and the central directory */
+
+/* Archive header at the start of the file, sets header->format */
+int archive_header_read(FILE* archive, ArchiveHeader* header){
+	uint8_t raw[ARCHIVE_HEADER_SIZE];
+	memset(header, 0, sizeof(ArchiveHeader));
+	if(fread(raw, 1, ARCHIVE_HEADER_SIZE, archive) != ARCHIVE_HEADER_SIZE)
+		return -1;
+	memcpy(header->magic, raw, 8);
+
+	if(memcmp(raw, MAGIC, 8) == 0){
+		header->format = FORMAT_LEGACY;
+		header->file_count = (uint64_t)(raw[8] | (raw[9] << 8));
+		header->total_size = get_le64(raw + 16);
+		header->has_password = raw[24];
+		return 0;
+	}
+	if(memcmp(raw, MAGIC_PACKED, 8) != 0 || get_le32(raw + 8) != FORMAT_PACKED)
+		return -1;
+
+	header->format = FORMAT_PACKED;
+	header->has_password = (get_le32(raw + 12) & ARCHIVE_FLAG_PASSWORD) != 0;
+	header->streamed = (get_le32(raw + 12) & ARCHIVE_FLAG_STREAM) != 0;
+	header->file_count = get_le64(raw + 16);
+	header->total_size = get_le64(raw + 24);
+	if(!header->has_password)
+		return 0;
+
+	/* Only the one cipher so far, a newer one is refused rather than misread */
+	if(fread(raw, 1, CIPHER_HEADER_SIZE, archive) != CIPHER_HEADER_SIZE || raw[20] != CIPHER_AES256_GCM ||
+		get_le32(raw + 16) == 0 || get_le32(raw + 16) > CIPHER_ITERATIONS_MAX)
+		return -1;
+	memcpy(header->salt, raw, CIPHER_SALT_SIZE);
+	header->iterations = get_le32(raw + 16);
+	memcpy(header->check, raw + 24, CIPHER_CHECK_SIZE);
+	return 0;
+}
+
+/* Write the header over the first bytes of the archive, a stream is still at them */
+int archive_header_write(FILE* archive, const ArchiveHeader* header){
+	uint8_t raw[ARCHIVE_HEADER_SIZE + CIPHER_HEADER_SIZE] = {0};
+	if(header->format == FORMAT_LEGACY){
+		/* Same bytes as the struct x86-64 builds used to write, the count
+		 * wraps at 16 bits there and readers take it from the directory */
+		memcpy(raw, MAGIC, 8);
+		raw[8] = header->file_count & 0xFF;
+		raw[9] = (header->file_count >> 8) & 0xFF;
+		put_le64(raw + 16, header->total_size);
+		raw[24] = header->has_password;
+	} else {
+		memcpy(raw, MAGIC_PACKED, 8);
+		put_le32(raw + 8, FORMAT_PACKED);
+		put_le32(raw + 12, (header->has_password ? ARCHIVE_FLAG_PASSWORD : 0) |
+			(header->streamed ? ARCHIVE_FLAG_STREAM : 0));
+		put_le64(raw + 16, header->file_count);
+		put_le64(raw + 24, header->total_size);
+		if(header->has_password){
+			memcpy(raw + ARCHIVE_HEADER_SIZE, header->salt, CIPHER_SALT_SIZE);
+			put_le32(raw + ARCHIVE_HEADER_SIZE + 16, header->iterations);
+			raw[ARCHIVE_HEADER_SIZE + 20] = CIPHER_AES256_GCM;
+			memcpy(raw + ARCHIVE_HEADER_SIZE + 24, header->check, CIPHER_CHECK_SIZE);
+		}
+	}
+
+	size_t size = (size_t)archive_header_size(header);
+	if((!header->streamed && fseeko(archive, 0, SEEK_SET) != 0) || fwrite(raw, 1, size, archive) != size)
+		return -1;
+	return 0;
+}
+
+/* Where the first member starts */
+uint64_t archive_header_size(const ArchiveHeader* header){
+	return ARCHIVE_HEADER_SIZE + ((header->format == FORMAT_PACKED && header->has_password) ? CIPHER_HEADER_SIZE : 0);
+}
+
+/* Key of a password archive, -1 when the password is not the one it was written with */
+int archive_key(const ArchiveHeader* header, const char* password, Cipher* cipher){
+	uint8_t check[CIPHER_CHECK_SIZE];
+	if(cipher_init(cipher, password, header->salt, header->iterations, check) != 0)
+		return -1;
+	return (memcmp(check, header->check, CIPHER_CHECK_SIZE) == 0) ? 0 : -1;
+}
+
+/* Bytes before the payload of a member with this name */
+size_t member_header_size(int format, const char* filename){
+	if(format == FORMAT_LEGACY)
+		return sizeof(FileHeader);
+	size_t name_len = strnlen(filename, sizeof(((FileHeader*)0)->filename) - 1);
+	return MEMBER_HEADER_FIXED + varint_size(name_len) + name_len;
+}
+
+/* Member header at the current position */
+int member_header_write(FILE* archive, int format, const FileHeader* header){
+	if(format == FORMAT_LEGACY)
+		return (fwrite(header, sizeof(FileHeader), 1, archive) == 1) ? 0 : -1;
+
+	uint8_t raw[MEMBER_HEADER_FIXED + 10 + sizeof(header->filename)];
+	size_t name_len = strnlen(header->filename, sizeof(header->filename) - 1);
+	raw[0] = header->is_compressed;
+	raw[1] = header->algorithm;
+	put_le32(raw + 2, header->permissions);
+	put_le64(raw + 6, header->file_size);
+	size_t size = MEMBER_HEADER_FIXED + put_varint(raw + MEMBER_HEADER_FIXED, name_len);
+	memcpy(raw + size, header->filename, name_len);
+	size += name_len;
+	return (fwrite(raw, 1, size, archive) == size) ? 0 : -1;
+}
+
+/* Member header at offset, its size or 0 if it can't be read */
+size_t member_header_read(FILE* archive, int format, off_t offset, FileHeader* header){
+	int fd = fileno(archive);
+	memset(header, 0, sizeof(FileHeader));
+	if(format == FORMAT_LEGACY){
+		if(pread(fd, header, sizeof(FileHeader), offset) != (ssize_t)sizeof(FileHeader))
+			return 0;
+		header->filename[sizeof(header->filename) - 1] = '\0';
+		return sizeof(FileHeader);
+	}
+
+	uint8_t raw[MEMBER_HEADER_FIXED + 10];
+	ssize_t got = pread(fd, raw, sizeof(raw), offset);
+	uint64_t name_len = 0;
+	size_t length_size = (got > MEMBER_HEADER_FIXED) ?
+		get_varint(raw + MEMBER_HEADER_FIXED, (size_t)got - MEMBER_HEADER_FIXED, &name_len) : 0;
+	if(length_size == 0 || name_len >= sizeof(header->filename))
+		return 0;
+
+	size_t fixed = MEMBER_HEADER_FIXED + length_size;
+	if(pread(fd, header->filename, (size_t)name_len, offset + (off_t)fixed) != (ssize_t)name_len)
+		return 0;
+	header->is_compressed = raw[0];
+	header->algorithm = raw[1];
+	header->permissions = get_le32(raw + 2);
+	header->file_size = get_le64(raw + 6);
+	header->offset = (uint64_t)offset;
+	return fixed + (size_t)name_len;
+}
+
+/* Packed member header at the current position of a stream, its size or 0 */
+size_t member_header_next(FILE* archive, int format, FileHeader* header){
+	memset(header, 0, sizeof(FileHeader));
+	uint8_t raw[MEMBER_HEADER_FIXED + 10];
+	if(format != FORMAT_PACKED || fread(raw, 1, MEMBER_HEADER_FIXED, archive) != MEMBER_HEADER_FIXED)
+		return 0;
+
+	/* Name length varint, a byte at a time so nothing past it is consumed */
+	size_t fixed = MEMBER_HEADER_FIXED;
+	int c = 0x80;
+	for(;fixed < sizeof(raw) && (c & 0x80) && (c = getc(archive)) != EOF;)
+		raw[fixed++] = (uint8_t)c;
+	uint64_t name_len = 0;
+	if(c == EOF || get_varint(raw + MEMBER_HEADER_FIXED, fixed - MEMBER_HEADER_FIXED, &name_len) == 0 ||
+		name_len >= sizeof(header->filename) || fread(header->filename, 1, (size_t)name_len, archive) != name_len)
+		return 0;
+
+	header->is_compressed = raw[0];
+	header->algorithm = raw[1];
+	header->permissions = get_le32(raw + 2);
+	header->file_size = get_le64(raw + 6);
+	return fixed + (size_t)name_len;
+}
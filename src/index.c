@@ -0,0 +1,384 @@
+#include "archive.h"
+
+static int index_read_footer(IndexReader* reader);
+static int index_next_header(IndexReader* reader, ArchiveEntry* entry);
+static int index_next_packed(IndexReader* reader, ArchiveEntry* entry);
+static const uint8_t* index_window(IndexReader* reader, size_t* left);
+static int index_spill(IndexWriter* writer);
+static uint64_t member_original_size(FILE* archive, const FileHeader* header, off_t payload);
+static int member_compare(const void* a, const void* b);
+
+/* Queue one directory entry for a member just written */
+int index_add(IndexWriter* writer, const FileHeader* header, uint64_t original_size, uint64_t mtime, uint32_t checksum){
+	size_t name_len = strnlen(header->filename, sizeof(header->filename) - 1);
+	size_t shared = 0;
+	for(;shared < name_len && header->filename[shared] == writer->last[shared]; shared++);
+	size_t need = (writer->version == INDEX_VERSION_FIXED) ? INDEX_ENTRY_SIZE + name_len :
+		7 * 10 + 6 + name_len - shared;
+
+	if(writer->size + need > INDEX_SPILL && index_spill(writer) != 0)
+		return -1;
+	if(writer->size + need > writer->capacity){
+		size_t capacity = writer->capacity ? writer->capacity * 2 : BUFFER * 16;
+		for(;capacity < writer->size + need; capacity *= 2);
+		uint8_t* data = realloc(writer->data, capacity);
+		if(!data)
+			return -1;
+		writer->data = data;
+		writer->capacity = capacity;
+	}
+
+	uint8_t* start = writer->data + writer->size;
+	uint8_t* p = start;
+	if(writer->version == INDEX_VERSION_FIXED){
+		/* name length, name, offset, packed, original, mtime, mode, flags, crc */
+		p[0] = name_len & 0xFF;
+		p[1] = (name_len >> 8) & 0xFF;
+		memcpy(p + 2, header->filename, name_len);
+		p += 2 + name_len;
+		put_le64(p, header->offset);
+		put_le64(p + 8, header->file_size);
+		put_le64(p + 16, original_size);
+		put_le64(p + 24, mtime);
+		put_le32(p + 32, header->permissions);
+		p[36] = header->is_compressed;
+		p[37] = header->algorithm;
+		put_le32(p + 38, checksum);
+
+		writer->size += need;
+		writer->count++;
+		return 0;
+	}
+
+	/* bytes shared with the previous name, rest of the name, then offset, packed,
+	 * original, mtime and mode as varints, flags, algorithm and crc */
+	p += put_varint(p, shared);
+	p += put_varint(p, name_len - shared);
+	memcpy(p, header->filename + shared, name_len - shared);
+	p += name_len - shared;
+	p += put_varint(p, header->offset);
+	p += put_varint(p, header->file_size);
+	p += put_varint(p, original_size);
+	p += put_varint(p, mtime);
+	p += put_varint(p, header->permissions);
+	p[0] = header->is_compressed;
+	p[1] = header->algorithm;
+	put_le32(p + 2, checksum);
+	p += 6;
+
+	memcpy(writer->last, header->filename, name_len);
+	writer->last[name_len] = '\0';
+	writer->size += (size_t)(p - start);
+	writer->count++;
+	return 0;
+}
+
+/* Move the entries held so far to the temporary file */
+int index_spill(IndexWriter* writer){
+	if(!writer->spill && !(writer->spill = tmpfile()))
+		return -1;
+	if(fwrite(writer->data, 1, writer->size, writer->spill) != writer->size)
+		return -1;
+	writer->spilled += writer->size;
+	writer->size = 0;
+	return 0;
+}
+
+/* Directory and the footer pointing at it, at the current position (offset) */
+int index_write(IndexWriter* writer, FILE* archive, uint64_t offset, uint64_t* written){
+	uint8_t footer[INDEX_FOOTER_SIZE] = {0};
+	memcpy(footer, INDEX_MAGIC, 8);
+	put_le32(footer + 8, writer->version ? writer->version : INDEX_VERSION);
+	put_le64(footer + 16, offset);
+	put_le64(footer + 24, writer->count);
+
+	/* Spilled entries first, they are the oldest */
+	if(writer->spill){
+		uint8_t chunk[BUFFER * 4];
+		uint64_t copied = 0;
+		if(fflush(writer->spill) != 0 || fseeko(writer->spill, 0, SEEK_SET) != 0)
+			return -1;
+		for(;copied < writer->spilled;){
+			size_t got = fread(chunk, 1, sizeof(chunk), writer->spill);
+			if(got == 0 || fwrite(chunk, 1, got, archive) != got)
+				return -1;
+			copied += got;
+		}
+	}
+
+	if((writer->size && fwrite(writer->data, 1, writer->size, archive) != writer->size) ||
+		fwrite(footer, 1, INDEX_FOOTER_SIZE, archive) != INDEX_FOOTER_SIZE)
+		return -1;
+
+	*written = writer->spilled + writer->size + INDEX_FOOTER_SIZE;
+	return 0;
+}
+
+void index_free(IndexWriter* writer){
+	if(writer->spill)
+		fclose(writer->spill);
+	free(writer->data);
+	memset(writer, 0, sizeof(IndexWriter));
+}
+
+/* Open an archive for listing, uses the directory when there is one */
+int index_open(const char* archive_path, IndexReader* reader){
+	memset(reader, 0, sizeof(IndexReader));
+	reader->file = fopen(archive_path, "rb");
+	if(!reader->file)
+		printErr("%d: Error: Cannot open archive %s: %s\n", __LINE__ - 2, archive_path, strerror(errno));
+
+	long int archive_size = getFileSize(reader->file);
+	if(archive_size < ARCHIVE_HEADER_SIZE){
+		fclose(reader->file);
+		printErr("%d: Error: Archive file is too small or empty\n", __LINE__ - 2);
+	}
+
+	if(archive_header_read(reader->file, &reader->header) != 0){
+		fclose(reader->file);
+		printErr("%d: Error: Invalid archive format - wrong magic number\n", __LINE__ - 2);
+	}
+
+	reader->archive_size = (uint64_t)archive_size;
+	reader->data_end = reader->archive_size;
+	if(index_read_footer(reader) != 0){
+		/* Archive from an older build, walk the member headers */
+		reader->count = reader->header.file_count;
+		reader->next = (off_t)archive_header_size(&reader->header);
+	}
+	return 0;
+}
+
+/* Locate the directory through the fixed footer */
+int index_read_footer(IndexReader* reader){
+	uint8_t footer[INDEX_FOOTER_SIZE];
+	if(reader->archive_size < ARCHIVE_HEADER_SIZE + INDEX_FOOTER_SIZE ||
+		fseeko(reader->file, (off_t)(reader->archive_size - INDEX_FOOTER_SIZE), SEEK_SET) != 0 ||
+		fread(footer, 1, INDEX_FOOTER_SIZE, reader->file) != INDEX_FOOTER_SIZE ||
+		memcmp(footer, INDEX_MAGIC, 8) != 0 || get_le32(footer + 8) < 1 || get_le32(footer + 8) > INDEX_VERSION)
+		return -1;
+
+	/* The directory is read through a fixed window as entries are parsed */
+	uint64_t offset = get_le64(footer + 16);
+	if(offset < ARCHIVE_HEADER_SIZE || offset > reader->archive_size - INDEX_FOOTER_SIZE ||
+		!(reader->window = malloc(INDEX_WINDOW)))
+		return -1;
+
+	reader->has_index = 1;
+	reader->version = get_le32(footer + 8);
+	reader->entry_size = (reader->version == 1) ? INDEX_ENTRY_SIZE_V1 : INDEX_ENTRY_SIZE;
+	reader->count = get_le64(footer + 24);
+	reader->directory = offset;
+	reader->directory_size = reader->archive_size - INDEX_FOOTER_SIZE - offset;
+	reader->data_end = offset;
+	reader->next = (off_t)offset;
+	return 0;
+}
+
+/* Directory bytes from the cursor on, a whole entry unless the directory ends first */
+const uint8_t* index_window(IndexReader* reader, size_t* left){
+	uint64_t end = reader->window_start + reader->window_length;
+	if(end - reader->cursor < INDEX_ENTRY_MAX && end < reader->directory_size){
+		size_t keep = (size_t)(end - reader->cursor);
+		memmove(reader->window, reader->window + (reader->cursor - reader->window_start), keep);
+		uint64_t want = reader->directory_size - end;
+		if(want > INDEX_WINDOW - keep)
+			want = INDEX_WINDOW - keep;
+		ssize_t got = pread(fileno(reader->file), reader->window + keep, (size_t)want,
+			(off_t)(reader->directory + end));
+		reader->window_start = reader->cursor;
+		reader->window_length = keep + (got > 0 ? (size_t)got : 0);
+	}
+	*left = (size_t)(reader->window_start + reader->window_length - reader->cursor);
+	return reader->window + (reader->cursor - reader->window_start);
+}
+
+/* Next member, 1 on success, 0 at the end, -1 on a damaged archive */
+int index_next(IndexReader* reader, ArchiveEntry* entry){
+	if(reader->position >= reader->count)
+		return 0;
+	if(!reader->has_index)
+		return index_next_header(reader, entry);
+	if(reader->version >= 3)
+		return index_next_packed(reader, entry);
+
+	size_t left;
+	const uint8_t* data = index_window(reader, &left);
+	if(left < 2)
+		return -1;
+
+	size_t name_len = data[0] | (data[1] << 8);
+	if(name_len >= sizeof(entry->filename) || left < reader->entry_size + name_len)
+		return -1;
+
+	/* Fixed fields follow the name, addressed as if the name was cut out */
+	memcpy(entry->filename, data + 2, name_len);
+	entry->filename[name_len] = '\0';
+	const uint8_t* fixed = data + name_len;
+	reader->cursor += reader->entry_size + name_len;
+
+	entry->offset = get_le64(fixed + 2);
+	entry->file_size = get_le64(fixed + 10);
+	entry->original_size = get_le64(fixed + 18);
+	entry->mtime = get_le64(fixed + 26);
+	entry->permissions = get_le32(fixed + 34);
+	entry->is_compressed = fixed[38];
+	entry->algorithm = fixed[39];
+	entry->has_checksum = reader->entry_size >= INDEX_ENTRY_SIZE;
+	entry->checksum = entry->has_checksum ? get_le32(fixed + 40) : 0;
+
+	if(entry->offset + member_header_size(reader->header.format, entry->filename) + entry->file_size > reader->data_end)
+		return -1;
+
+	reader->position++;
+	return 1;
+}
+
+/* Version 3 entry, see index_add */
+int index_next_packed(IndexReader* reader, ArchiveEntry* entry){
+	size_t left;
+	const uint8_t* data = index_window(reader, &left);
+	uint64_t shared, suffix, fields[5];
+
+	size_t at = get_varint(data, left, &shared);
+	size_t used = at ? get_varint(data + at, left - at, &suffix) : 0;
+	if(!used)
+		return -1;
+	at += used;
+	if(shared > reader->last_length || suffix > left - at || shared + suffix >= sizeof(entry->filename))
+		return -1;
+	memcpy(entry->filename, reader->last, (size_t)shared);
+	memcpy(entry->filename + shared, data + at, (size_t)suffix);
+	entry->filename[shared + suffix] = '\0';
+	at += (size_t)suffix;
+
+	for(int i = 0; i < 5; i++){
+		if(!(used = get_varint(data + at, left - at, &fields[i])))
+			return -1;
+		at += used;
+	}
+	if(left - at < 6)
+		return -1;
+
+	entry->offset = fields[0];
+	entry->file_size = fields[1];
+	entry->original_size = fields[2];
+	entry->mtime = fields[3];
+	entry->permissions = (uint32_t)fields[4];
+	entry->is_compressed = data[at];
+	entry->algorithm = data[at + 1];
+	entry->checksum = get_le32(data + at + 2);
+	entry->has_checksum = 1;
+	reader->cursor += at + 6;
+	reader->last_length = (size_t)(shared + suffix);
+	memcpy(reader->last, entry->filename, reader->last_length + 1);
+
+	uint64_t header_size = member_header_size(reader->header.format, entry->filename);
+	if(entry->offset + entry->file_size < entry->offset ||
+		entry->offset + header_size + entry->file_size > reader->data_end)
+		return -1;
+
+	reader->position++;
+	return 1;
+}
+
+/* Legacy listing: read each member header and hop over its payload */
+int index_next_header(IndexReader* reader, ArchiveEntry* entry){
+	FileHeader header;
+	memset(entry, 0, sizeof(ArchiveEntry));
+	size_t header_size = member_header_read(reader->file, reader->header.format, reader->next, &header);
+	if(header_size == 0)
+		return -1;
+
+	off_t payload = reader->next + (off_t)header_size;
+	if((uint64_t)payload + header.file_size > reader->archive_size)
+		return -1;
+
+	memcpy(entry->filename, header.filename, sizeof(entry->filename) - 1);
+	entry->offset = (uint64_t)reader->next;
+	entry->file_size = header.file_size;
+	entry->original_size = member_original_size(reader->file, &header, payload);
+	entry->permissions = header.permissions;
+	entry->is_compressed = header.is_compressed;
+	entry->algorithm = header.algorithm;
+
+	reader->next = payload + (off_t)header.file_size;
+	reader->position++;
+	return 1;
+}
+
+/* Original size as recorded inside the payload itself */
+uint64_t member_original_size(FILE* archive, const FileHeader* header, off_t payload){
+	uint8_t field[8];
+	if(!header->is_compressed)
+		return header->file_size;
+
+	/* Block coders share the frame, its tail holds the size */
+	const Codec* codec = codec_find(header->algorithm);
+	if(codec && codec->decompress && header->file_size >= FRAME_TAIL_SIZE &&
+		pread(fileno(archive), field, 8, payload + (off_t)header->file_size - 8) == 8)
+		return get_le64(field);
+
+	if(header->algorithm == ALGO_RLE && header->file_size >= 4 &&
+		pread(fileno(archive), field, 4, payload) == 4)
+		return ((uint64_t)field[0] << 24) | (field[1] << 16) | (field[2] << 8) | field[3];
+
+	return 0;
+}
+
+void index_close(IndexReader* reader){
+	free(reader->window);
+	reader->window = NULL;
+	if(reader->file)
+		fclose(reader->file);
+	reader->file = NULL;
+}
+
+/* Every member of an open archive, sorted for members_find */
+int members_load(IndexReader* reader, MemberSet* set){
+	memset(set, 0, sizeof(MemberSet));
+	set->members = calloc(reader->count ? reader->count : 1, sizeof(PreviousMember));
+	if(!set->members)
+		return -1;
+
+	ArchiveEntry entry;
+	int next;
+	for(;(next = index_next(reader, &entry)) > 0;){
+		PreviousMember* member = &set->members[set->count];
+		member->filename = strdup(entry.filename);
+		if(!member->filename)
+			return -1;
+		member->offset = entry.offset;
+		member->file_size = entry.file_size;
+		member->original_size = entry.original_size;
+		member->mtime = entry.mtime;
+		member->permissions = entry.permissions;
+		member->checksum = entry.checksum;
+		member->is_compressed = entry.is_compressed;
+		member->algorithm = entry.algorithm;
+		member->has_checksum = entry.has_checksum;
+		set->count++;
+	}
+	if(next < 0)
+		return -1;
+
+	qsort(set->members, set->count, sizeof(PreviousMember), member_compare);
+	return 0;
+}
+
+int member_compare(const void* a, const void* b){
+	return strcmp(((const PreviousMember*)a)->filename, ((const PreviousMember*)b)->filename);
+}
+
+PreviousMember* members_find(MemberSet* set, const char* filename){
+	PreviousMember key;
+	key.filename = (char*)filename;
+	return set->count ? bsearch(&key, set->members, set->count, sizeof(PreviousMember), member_compare) : NULL;
+}
+
+void members_free(MemberSet* set){
+	for(uint64_t i = 0; set->members && i < set->count; i++)
+		free(set->members[i].filename);
+	free(set->members);
+	memset(set, 0, sizeof(MemberSet));
+}
@@ -13,3 +13,55 @@ int printErr(char *msg, ...){
 
 	exit(errno);
 }
+
+/* little-endian packing for on-disk fields */
+void put_le32(uint8_t* dst, uint32_t value){
+	for(int i = 0; i < 4; i++)
+		dst[i] = (value >> (8 * i)) & 0xFF;
+}
+
+void put_le64(uint8_t* dst, uint64_t value){
+	for(int i = 0; i < 8; i++)
+		dst[i] = (value >> (8 * i)) & 0xFF;
+}
+
+uint32_t get_le32(const uint8_t* src){
+	uint32_t value = 0;
+	for(int i = 3; i >= 0; i--)
+		value = (value << 8) | src[i];
+	return value;
+}
+
+uint64_t get_le64(const uint8_t* src){
+	uint64_t value = 0;
+	for(int i = 7; i >= 0; i--)
+		value = (value << 8) | src[i];
+	return value;
+}
+
+/* LEB128, 7 bits a byte with the high bit set on all but the last */
+size_t put_varint(uint8_t* dst, uint64_t value){
+	size_t i = 0;
+	for(;value > 0x7F; value >>= 7)
+		dst[i++] = (uint8_t)(value & 0x7F) | 0x80;
+	dst[i++] = (uint8_t)value;
+	return i;
+}
+
+/* Bytes consumed, 0 if the varint is cut short or too long */
+size_t get_varint(const uint8_t* src, size_t length, uint64_t* value){
+	*value = 0;
+	for(size_t i = 0; i < length && i < 10; i++){
+		*value |= (uint64_t)(src[i] & 0x7F) << (7 * i);
+		if(!(src[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+size_t varint_size(uint64_t value){
+	size_t size = 1;
+	for(;value > 0x7F; value >>= 7)
+		size++;
+	return size;
+}
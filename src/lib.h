@@ -11,5 +11,12 @@
 #define BUFFER 4096
 
 int printErr(char *msg, ...);
+void put_le32(uint8_t* dst, uint32_t value);
+void put_le64(uint8_t* dst, uint64_t value);
+uint32_t get_le32(const uint8_t* src);
+uint64_t get_le64(const uint8_t* src);
+size_t put_varint(uint8_t* dst, uint64_t value);
+size_t get_varint(const uint8_t* src, size_t length, uint64_t* value);
+size_t varint_size(uint64_t value);
 
 #endif
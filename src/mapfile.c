@@ -0,0 +1,99 @@
+#include "mapfile.h"
+
+static int read_range(int fd, uint64_t offset, uint64_t length, MappedFile* map);
+
+/* View length bytes at offset, the kernel pages them in as the codec reads */
+int map_range(int fd, uint64_t offset, uint64_t length, int flags, MappedFile* map){
+	memset(map, 0, sizeof(MappedFile));
+	if(length == 0)
+		return 0;
+
+	/* Only regular files map reliably, pipes and devices are read */
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && page > 0 &&
+		offset + length <= (uint64_t)st.st_size && length <= SIZE_MAX - (size_t)page){
+		uint64_t aligned = offset & ~((uint64_t)page - 1);
+		size_t span = (size_t)(length + (offset - aligned));
+		void* base = mmap(NULL, span, PROT_READ, MAP_SHARED, fd, (off_t)aligned);
+		if(base != MAP_FAILED){
+			madvise(base, span, MADV_SEQUENTIAL);
+			madvise(base, span, MADV_WILLNEED);
+			map->base = base;
+			map->length = span;
+			map->data = (const uint8_t*)base + (offset - aligned);
+			map->size = length;
+			map->mapped = 1;
+			return 0;
+		}
+	}
+
+	if(!(flags & MAP_READ_FALLBACK) || length > SIZE_MAX)
+		return -1;
+	return read_range(fd, offset, length, map);
+}
+
+/* Fallback: plain reads, positioned when the descriptor can seek */
+int read_range(int fd, uint64_t offset, uint64_t length, MappedFile* map){
+	uint8_t* buffer = malloc((size_t)length);
+	if(!buffer)
+		return -1;
+
+	int seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+	uint64_t done = 0;
+	for(;done < length;){
+		ssize_t got = seekable ? pread(fd, buffer + done, (size_t)(length - done), (off_t)(offset + done))
+			: read(fd, buffer + done, (size_t)(length - done));
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			break;
+		done += (uint64_t)got;
+	}
+
+	if(done != length){
+		free(buffer);
+		return -1;
+	}
+
+	map->base = buffer;
+	map->length = (size_t)length;
+	map->data = buffer;
+	map->size = length;
+	return 0;
+}
+
+void map_release(MappedFile* map){
+	if(map->mapped)
+		munmap(map->base, map->length);
+	else
+		free(map->base);
+	memset(map, 0, sizeof(MappedFile));
+}
+
+/* Grow a new, empty file to length and map it for writing. Only done when
+ * the filesystem reserves the blocks, a full disk would otherwise surface
+ * as SIGBUS in the middle of a decode rather than as an error */
+int map_output(int fd, uint64_t length, OutputMap* map){
+	memset(map, 0, sizeof(OutputMap));
+	if(length == 0 || length > SIZE_MAX)
+		return -1;
+
+	void* base = mmap(NULL, (size_t)length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED)
+		return -1;
+	if(syscall(SYS_fallocate, fd, 0, (off_t)0, (off_t)length) != 0){
+		munmap(base, (size_t)length);
+		return -1;
+	}
+	map->data = base;
+	map->size = length;
+	return 0;
+}
+
+/* Pages stay in the page cache, written back like any other write */
+int unmap_output(OutputMap* map){
+	int status = (map->data && munmap(map->data, (size_t)map->size) != 0) ? -1 : 0;
+	memset(map, 0, sizeof(OutputMap));
+	return status;
+}
@@ -0,0 +1,40 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+/* map_range flags */
+#define MAP_READ_FALLBACK 1       /* read() into memory when mmap is refused */
+
+/* Read-only view of a file range, mapped or read into a buffer */
+typedef struct {
+	const uint8_t* data;      /* first byte of the requested range */
+	uint64_t size;
+	void* base;               /* page aligned mapping or malloc'd copy */
+	size_t length;
+	int mapped;
+} MappedFile;
+
+/* Writable view of a whole output file, its blocks reserved up front */
+typedef struct {
+	uint8_t* data;
+	uint64_t size;
+} OutputMap;
+
+/* Function declarations */
+int map_range(int fd, uint64_t offset, uint64_t length, int flags, MappedFile* map);
+void map_release(MappedFile* map);
+int map_output(int fd, uint64_t length, OutputMap* map);
+int unmap_output(OutputMap* map);
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ppm.h"
+
+/* Range coder (carryless, Subbotin) */
+#define RC_TOP (1u << 24)
+#define RC_BOT (1u << 16)
+
+typedef struct {
+	uint32_t low;
+	uint32_t range;
+	uint32_t code;
+	uint8_t* out;
+	size_t out_size;
+	const uint8_t* in;
+	size_t in_size;
+	size_t pos;
+	int overflow;
+} RangeCoder;
+
+static void rc_put(RangeCoder* rc, uint8_t byte);
+static uint8_t rc_get(RangeCoder* rc);
+static void rc_encode(RangeCoder* rc, uint32_t cum, uint32_t freq, uint32_t total);
+static uint32_t rc_get_freq(RangeCoder* rc, uint32_t total);
+static void rc_decode(RangeCoder* rc, uint32_t cum, uint32_t freq);
+static void ppm_model_reset(PPMModel* model);
+static void ppm_context_slots(const PPMModel* model, size_t* slots);
+static uint32_t ppm_block_alloc(PPMModel* model, int class);
+static void ppm_block_free(PPMModel* model, uint32_t block, int class);
+static int ppm_context_grow(PPMModel* model, PPMContext* context);
+static void ppm_model_update(PPMModel* model, const size_t* slots, uint8_t symbol);
+static void ppm_next_stamp(PPMModel* model);
+
+void rc_put(RangeCoder* rc, uint8_t byte){
+	if(rc->pos >= rc->out_size){
+		rc->overflow = 1;
+		return;
+	}
+	rc->out[rc->pos++] = byte;
+}
+
+uint8_t rc_get(RangeCoder* rc){
+	/* Reading past the end yields zeros, the encoder flushed enough bytes */
+	return (rc->pos < rc->in_size) ? rc->in[rc->pos++] : 0;
+}
+
+void rc_encode(RangeCoder* rc, uint32_t cum, uint32_t freq, uint32_t total){
+	rc->range /= total;
+	rc->low += cum * rc->range;
+	rc->range *= freq;
+	for(;(rc->low ^ (rc->low + rc->range)) < RC_TOP ||
+		(rc->range < RC_BOT && ((rc->range = -rc->low & (RC_BOT - 1)), 1));){
+		rc_put(rc, rc->low >> 24);
+		rc->low <<= 8;
+		rc->range <<= 8;
+	}
+}
+
+uint32_t rc_get_freq(RangeCoder* rc, uint32_t total){
+	rc->range /= total;
+	uint32_t value = (rc->code - rc->low) / rc->range;
+	return (value < total) ? value : total - 1;
+}
+
+void rc_decode(RangeCoder* rc, uint32_t cum, uint32_t freq){
+	rc->low += cum * rc->range;
+	rc->range *= freq;
+	for(;(rc->low ^ (rc->low + rc->range)) < RC_TOP ||
+		(rc->range < RC_BOT && ((rc->range = -rc->low & (RC_BOT - 1)), 1));){
+		rc->code = (rc->code << 8) | rc_get(rc);
+		rc->low <<= 8;
+		rc->range <<= 8;
+	}
+}
+
+/* Initialise model, table and arena sizes follow the memory limit */
+int ppm_model_init(PPMModel* model, int order, size_t memory_limit){
+	memset(model, 0, sizeof(PPMModel));
+	if(order < 0)
+		order = 0;
+	if(order > PPM_MAX_ORDER)
+		order = PPM_MAX_ORDER;
+	if(memory_limit < PPM_MIN_MEMORY)
+		memory_limit = PPM_MIN_MEMORY;
+
+	/* A quarter of the budget goes to slots, the rest to symbols */
+	size_t table_size = 1;
+	for(;table_size * 2 * PPM_SLOT_COST <= memory_limit / 4; table_size *= 2);
+
+	/* A block is under twice its symbols and the blocks it outgrew add up to
+	 * less than itself, so four arena symbols per charged one always do */
+	size_t arena_size = (memory_limit - table_size * PPM_SLOT_COST) / PPM_SYMBOL_COST * 4;
+	if(arena_size >= PPM_NO_BLOCK)
+		return -1;
+
+	model->contexts = calloc(table_size, sizeof(PPMContext));
+	model->arena = malloc(arena_size * sizeof(PPMSymbol));
+	if(!model->contexts || !model->arena){
+		free(model->contexts);
+		free(model->arena);
+		model->contexts = NULL;
+		return -1;
+	}
+
+	model->order = order;
+	model->memory_limit = memory_limit;
+	model->table_size = table_size;
+	model->arena_size = arena_size;
+	ppm_model_reset(model);
+	return 0;
+}
+
+/* Drop all statistics, keep the table and arena */
+void ppm_model_reset(PPMModel* model){
+	memset(model->contexts, 0, model->table_size * sizeof(PPMContext));
+	for(int i = 0; i < PPM_CLASSES; i++)
+		model->free_blocks[i] = PPM_NO_BLOCK;
+	model->arena_used = 0;
+	model->memory_used = model->table_size * PPM_SLOT_COST;
+}
+
+void ppm_model_free(PPMModel* model){
+	if(!model->contexts)
+		return;
+	free(model->contexts);
+	free(model->arena);
+	model->contexts = NULL;
+	model->arena = NULL;
+}
+
+/* Block of 2^class symbols, an outgrown one of that size first */
+uint32_t ppm_block_alloc(PPMModel* model, int class){
+	uint32_t block = model->free_blocks[class];
+	if(block != PPM_NO_BLOCK){
+		memcpy(&model->free_blocks[class], &model->arena[block], sizeof(uint32_t));
+		return block;
+	}
+	if(model->arena_used + ((size_t)1 << class) > model->arena_size)
+		return PPM_NO_BLOCK;
+	block = (uint32_t)model->arena_used;
+	model->arena_used += (size_t)1 << class;
+	return block;
+}
+
+void ppm_block_free(PPMModel* model, uint32_t block, int class){
+	memcpy(&model->arena[block], &model->free_blocks[class], sizeof(uint32_t));
+	model->free_blocks[class] = block;
+}
+
+/* Room for one more symbol, a full block moves to one twice its size */
+int ppm_context_grow(PPMModel* model, PPMContext* context){
+	if(context->used & (context->used - 1))
+		return 0;
+	int class = context->used ? __builtin_ctz(context->used) + 1 : 0;
+	uint32_t block = ppm_block_alloc(model, class);
+	if(block == PPM_NO_BLOCK)
+		return -1;
+	if(context->used){
+		memcpy(model->arena + block, model->arena + context->block, context->used * sizeof(PPMSymbol));
+		ppm_block_free(model, context->block, class - 1);
+	}
+	context->block = block;
+	return 0;
+}
+
+/* Hash every available context order into a table slot */
+void ppm_context_slots(const PPMModel* model, size_t* slots){
+	uint32_t hash = 0x811C9DC5u;
+	slots[0] = 0;
+	for(int k = 1; k <= model->order && k <= model->history_len; k++){
+		hash = (hash ^ model->history[k - 1]) * 0x01000193u;
+		uint32_t mixed = (hash + (uint32_t)k * 0x9E3779B9u);
+		mixed ^= mixed >> 15;
+		mixed *= 0x2C1B3C6Du;
+		mixed ^= mixed >> 12;
+		slots[k] = mixed & (model->table_size - 1);
+	}
+}
+
+/* Count symbol in every order, restart the model when over budget */
+void ppm_model_update(PPMModel* model, const size_t* slots, uint8_t symbol){
+	int max_order = (model->history_len < model->order) ? model->history_len : model->order;
+
+	for(int k = 0; k <= max_order; k++){
+		PPMContext* context = &model->contexts[slots[k]];
+		PPMSymbol* symbols = model->arena + context->block;
+		int i = (int)context->used - 1;
+		for(;i >= 0 && symbols[i].symbol != symbol; i--);
+
+		if(i < 0){
+			if(model->memory_used + PPM_SYMBOL_COST > model->memory_limit)
+				ppm_model_reset(model);
+			if(ppm_context_grow(model, context) != 0)
+				continue;
+			symbols = model->arena + context->block;
+			i = context->used++;
+			symbols[i].symbol = symbol;
+			symbols[i].count = 0;
+			model->memory_used += PPM_SYMBOL_COST;
+		}
+		symbols[i].count++;
+
+		if(++context->total > PPM_MAX_TOTAL){
+			context->total = 0;
+			for(i = 0; i < context->used; i++){
+				symbols[i].count = (symbols[i].count + 1) / 2;
+				context->total += symbols[i].count;
+			}
+		}
+	}
+
+	memmove(model->history + 1, model->history, PPM_MAX_ORDER - 1);
+	model->history[0] = symbol;
+	if(model->history_len < PPM_MAX_ORDER)
+		model->history_len++;
+}
+
+void ppm_next_stamp(PPMModel* model){
+	if(++model->stamp == 0){
+		memset(model->excluded, 0, sizeof(model->excluded));
+		model->stamp = 1;
+	}
+}
+
+/* Encode input, returns output length or 0 if it does not fit */
+size_t ppm_encode(PPMModel* model, const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size){
+	RangeCoder rc = {0};
+	rc.range = 0xFFFFFFFFu;
+	rc.out = output;
+	rc.out_size = output_size;
+
+	size_t slots[PPM_MAX_ORDER + 1];
+	for(size_t i = 0; i < input_size && !rc.overflow; i++){
+		uint8_t symbol = input[i];
+		int max_order = (model->history_len < model->order) ? model->history_len : model->order;
+		int coded = 0, escaped = 0;
+
+		ppm_next_stamp(model);
+		ppm_context_slots(model, slots);
+
+		for(int k = max_order; k >= 0 && !coded; k--){
+			const PPMContext* context = &model->contexts[slots[k]];
+			const PPMSymbol* symbols = model->arena + context->block;
+			uint32_t total = 0, distinct = 0, cum = 0, freq = 0;
+			if(!escaped){
+				/* Nothing excluded yet, the context keeps its own total */
+				total = context->total;
+				distinct = context->used;
+				for(int j = (int)context->used - 1; j >= 0 && !freq; j--){
+					if(symbols[j].symbol == symbol)
+						freq = symbols[j].count;
+					else
+						cum += symbols[j].count;
+				}
+			} else {
+				for(int j = (int)context->used - 1; j >= 0; j--){
+					if(model->excluded[symbols[j].symbol] == model->stamp)
+						continue;
+					if(symbols[j].symbol == symbol){
+						cum = total;
+						freq = symbols[j].count;
+					}
+					total += symbols[j].count;
+					distinct++;
+				}
+			}
+			if(distinct == 0)
+				continue;
+
+			if(freq){
+				rc_encode(&rc, cum, freq, total + distinct);
+				coded = 1;
+			} else {
+				/* Escape, PPMC weights it by the number of distinct symbols */
+				rc_encode(&rc, total, distinct, total + distinct);
+				for(int j = 0; j < context->used; j++)
+					model->excluded[symbols[j].symbol] = model->stamp;
+				escaped = 1;
+			}
+		}
+
+		if(!coded){
+			/* Order -1: uniform over symbols not yet excluded */
+			uint32_t cum = 0, total = 0;
+			for(int s = 0; s < 256; s++){
+				if(model->excluded[s] == model->stamp)
+					continue;
+				if(s < symbol)
+					cum++;
+				total++;
+			}
+			rc_encode(&rc, cum, 1, total);
+		}
+
+		ppm_model_update(model, slots, symbol);
+	}
+
+	for(int i = 0; i < 4; i++){
+		rc_put(&rc, rc.low >> 24);
+		rc.low <<= 8;
+	}
+
+	return rc.overflow ? 0 : rc.pos;
+}
+
+/* Decode output_size symbols, returns number of bytes produced */
+size_t ppm_decode(PPMModel* model, const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size){
+	RangeCoder rc = {0};
+	rc.range = 0xFFFFFFFFu;
+	rc.in = input;
+	rc.in_size = input_size;
+	for(int i = 0; i < 4; i++)
+		rc.code = (rc.code << 8) | rc_get(&rc);
+
+	size_t slots[PPM_MAX_ORDER + 1];
+	size_t i = 0;
+	for(;i < output_size; i++){
+		int max_order = (model->history_len < model->order) ? model->history_len : model->order;
+		int symbol = -1, escaped = 0;
+
+		ppm_next_stamp(model);
+		ppm_context_slots(model, slots);
+
+		for(int k = max_order; k >= 0 && symbol < 0; k--){
+			const PPMContext* context = &model->contexts[slots[k]];
+			const PPMSymbol* symbols = model->arena + context->block;
+			uint32_t total = 0, distinct = 0;
+			if(!escaped){
+				total = context->total;
+				distinct = context->used;
+			} else
+				for(int j = (int)context->used - 1; j >= 0; j--){
+					if(model->excluded[symbols[j].symbol] == model->stamp)
+						continue;
+					total += symbols[j].count;
+					distinct++;
+				}
+			if(distinct == 0)
+				continue;
+
+			uint32_t target = rc_get_freq(&rc, total + distinct);
+			if(target >= total){
+				rc_decode(&rc, total, distinct);
+				for(int j = 0; j < context->used; j++)
+					model->excluded[symbols[j].symbol] = model->stamp;
+				escaped = 1;
+				continue;
+			}
+
+			uint32_t cum = 0;
+			for(int j = (int)context->used - 1; j >= 0; j--){
+				if(escaped && model->excluded[symbols[j].symbol] == model->stamp)
+					continue;
+				if(target < cum + symbols[j].count){
+					rc_decode(&rc, cum, symbols[j].count);
+					symbol = symbols[j].symbol;
+					break;
+				}
+				cum += symbols[j].count;
+			}
+		}
+
+		if(symbol < 0){
+			uint32_t total = 0;
+			for(int s = 0; s < 256; s++)
+				if(model->excluded[s] != model->stamp)
+					total++;
+			if(total == 0)
+				break;
+
+			uint32_t target = rc_get_freq(&rc, total);
+			uint32_t cum = 0;
+			for(int s = 0; s < 256; s++){
+				if(model->excluded[s] == model->stamp)
+					continue;
+				if(cum == target){
+					symbol = s;
+					break;
+				}
+				cum++;
+			}
+			rc_decode(&rc, target, 1);
+		}
+
+		output[i] = (uint8_t)symbol;
+		ppm_model_update(model, slots, (uint8_t)symbol);
+	}
+
+	return i;
+}
@@ -0,0 +1,54 @@
+#ifndef PPM_H
+#define PPM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* defines */
+#define PPM_DEFAULT_ORDER 4
+#define PPM_MAX_ORDER 16
+#define PPM_MIN_MEMORY (64UL << 10)
+#define PPM_DEFAULT_MEMORY (32UL << 20)
+#define PPM_MAX_TOTAL 16384     /* rescale threshold, must stay below the coder's 2^16 */
+#define PPM_SLOT_COST 8         /* budget charged per table slot */
+#define PPM_SYMBOL_COST 16      /* and per symbol, the charges of the list model so resets stay where they were */
+#define PPM_CLASSES 9           /* symbol block capacities 1, 2, 4 ... 256 */
+#define PPM_NO_BLOCK UINT32_MAX
+
+/* Symbol seen in a context */
+typedef struct {
+	uint16_t count;
+	uint8_t symbol;
+} PPMSymbol;
+
+/* Table slot, its symbols are one arena block, newest last */
+typedef struct {
+	uint32_t block;           /* arena index of the first symbol */
+	uint16_t used;            /* symbols in the block, 0 when empty */
+	uint16_t total;           /* sum of their counts */
+} PPMContext;
+
+/* PPM model structure */
+typedef struct {
+	PPMContext* contexts;     /* hashed context table */
+	int order;                /* highest context order */
+	size_t memory_limit;      /* model budget in bytes, model restarts when hit */
+	size_t table_size;        /* number of slots in contexts */
+	size_t memory_used;       /* budget charged for the table and symbols */
+	PPMSymbol* arena;         /* symbol blocks, sized so the budget runs out first */
+	size_t arena_size;        /* in symbols */
+	size_t arena_used;
+	uint32_t free_blocks[PPM_CLASSES];  /* outgrown blocks by capacity, linked through their first symbol */
+	uint8_t history[PPM_MAX_ORDER]; /* previous bytes, most recent first */
+	int history_len;
+	uint32_t excluded[256];   /* exclusion marks, valid when equal to stamp */
+	uint32_t stamp;
+} PPMModel;
+
+/* Function declarations */
+int ppm_model_init(PPMModel* model, int order, size_t memory_limit);
+void ppm_model_free(PPMModel* model);
+size_t ppm_encode(PPMModel* model, const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
+size_t ppm_decode(PPMModel* model, const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
+
+#endif
@@ -0,0 +1,337 @@
+#include "readahead.h"
+
+/* Kept out of the header, linux/fs.h behind it has a BLOCK_SIZE of its own */
+#ifdef SYS_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+/* Request stages, carried in the low bits of the ring's user data */
+#define STAGE_OPEN 0
+#define STAGE_READ 1
+#define STAGE_CLOSE 2
+#define STAGE_MASK 3
+
+static void* readahead_reader(void* arg);
+static void read_whole(ReadRequest* request);
+#ifdef SYS_io_uring_setup
+static int ring_setup(ReadRing* ring, unsigned entries);
+static int ring_supported(int fd);
+static void ring_free(ReadRing* ring);
+static struct io_uring_sqe* ring_entry(ReadRing* ring, uint8_t opcode, int fd, ReadRequest* request, int stage);
+static int ring_enter(ReadRing* ring, unsigned wait);
+static int ring_complete(ReadRing* ring, const struct io_uring_cqe* cqe);
+static void* readahead_ring(void* arg);
+#endif
+
+/* One thread drives an io_uring when the kernel has one, otherwise a few
+ * threads block in read. Without either nothing is read ahead */
+int readahead_start(ReadAhead* ahead){
+	memset(ahead, 0, sizeof(ReadAhead));
+	ahead->ring.fd = -1;
+	pthread_mutex_init(&ahead->lock, NULL);
+	pthread_cond_init(&ahead->work, NULL);
+	pthread_cond_init(&ahead->done, NULL);
+
+	int count = READAHEAD_THREADS;
+	void* (*reader)(void*) = readahead_reader;
+#ifdef SYS_io_uring_setup
+	if(ring_setup(&ahead->ring, READAHEAD_DEPTH * 2) == 0){
+		count = 1;
+		reader = readahead_ring;
+	}
+#endif
+	if((ahead->readers = calloc((size_t)count, sizeof(pthread_t))))
+		for(;ahead->reader_count < count &&
+			pthread_create(&ahead->readers[ahead->reader_count], NULL, reader, ahead) == 0; ahead->reader_count++);
+	if(ahead->reader_count == 0){
+		readahead_stop(ahead);
+		return -1;
+	}
+	return 0;
+}
+
+/* Every submitted request must have been waited for */
+void readahead_stop(ReadAhead* ahead){
+	pthread_mutex_lock(&ahead->lock);
+	ahead->finished = 1;
+	pthread_cond_broadcast(&ahead->work);
+	pthread_mutex_unlock(&ahead->lock);
+	for(int i = 0; i < ahead->reader_count; i++)
+		pthread_join(ahead->readers[i], NULL);
+
+#ifdef SYS_io_uring_setup
+	ring_free(&ahead->ring);
+#endif
+	pthread_mutex_destroy(&ahead->lock);
+	pthread_cond_destroy(&ahead->work);
+	pthread_cond_destroy(&ahead->done);
+	free(ahead->readers);
+	ahead->readers = NULL;
+	ahead->reader_count = 0;
+}
+
+/* Queue a whole file read, -1 leaves the request idle for the consumer to open */
+int readahead_submit(ReadAhead* ahead, ReadRequest* request, const char* path, uint64_t size){
+	memset(request, 0, sizeof(ReadRequest));
+	if(ahead->reader_count == 0 || size == 0 || size > READAHEAD_LIMIT || !(request->data = malloc(size + 1)))
+		return -1;
+	request->path = path;
+	request->size = size;
+	request->fd = -1;
+	request->state = READ_QUEUED;
+	request->ahead = ahead;
+
+	pthread_mutex_lock(&ahead->lock);
+	if(ahead->tail)
+		ahead->tail->queued = request;
+	else
+		ahead->head = request;
+	ahead->tail = request;
+	pthread_cond_signal(&ahead->work);
+	pthread_mutex_unlock(&ahead->lock);
+	return 0;
+}
+
+/* Hand the file over as a buffer owned by source. -1 when it wasn't read
+ * ahead or changed since the walk, the caller then opens it itself */
+int readahead_wait(ReadRequest* request, MappedFile* source){
+	ReadAhead* ahead = request->ahead;
+	if(!ahead)
+		return -1;
+
+	pthread_mutex_lock(&ahead->lock);
+	for(;request->state == READ_QUEUED;)
+		pthread_cond_wait(&ahead->done, &ahead->lock);
+	pthread_mutex_unlock(&ahead->lock);
+
+	int status = -1;
+	if(request->state == READ_DONE){
+		memset(source, 0, sizeof(MappedFile));
+		source->base = request->data;
+		source->length = (size_t)request->size;
+		source->data = request->data;
+		source->size = request->size;
+		status = 0;
+	} else
+		free(request->data);
+	memset(request, 0, sizeof(ReadRequest));
+	return status;
+}
+
+/* Blocking reader, one file at a time */
+void* readahead_reader(void* arg){
+	ReadAhead* ahead = arg;
+	pthread_mutex_lock(&ahead->lock);
+	for(;;){
+		for(;!ahead->head && !ahead->finished;)
+			pthread_cond_wait(&ahead->work, &ahead->lock);
+		if(!ahead->head)
+			break;
+
+		ReadRequest* request = ahead->head;
+		ahead->head = request->queued;
+		if(!ahead->head)
+			ahead->tail = NULL;
+		pthread_mutex_unlock(&ahead->lock);
+
+		read_whole(request);
+
+		pthread_mutex_lock(&ahead->lock);
+		request->state = (request->got == (int64_t)request->size) ? READ_DONE : READ_MISSED;
+		pthread_cond_broadcast(&ahead->done);
+	}
+	pthread_mutex_unlock(&ahead->lock);
+	return NULL;
+}
+
+/* Read up to one byte past the walked size, so growth shows as a miss */
+void read_whole(ReadRequest* request){
+	request->got = -1;
+	int fd = open(request->path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return;
+
+	uint64_t done = 0;
+	for(;done <= request->size;){
+		ssize_t got = read(fd, request->data + done, (size_t)(request->size + 1 - done));
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got <= 0)
+			break;
+		done += (uint64_t)got;
+	}
+	close(fd);
+	request->got = (int64_t)done;
+}
+
+#ifdef SYS_io_uring_setup
+/* Map the rings of a new io_uring, -1 when the kernel has none or can't open files through it */
+int ring_setup(ReadRing* ring, unsigned entries){
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(ReadRing));
+	ring->fd = (int)syscall(SYS_io_uring_setup, entries, &params);
+	if(ring->fd < 0 || !ring_supported(ring->fd)){
+		ring_free(ring);
+		return -1;
+	}
+
+	/* Newer kernels share one mapping between both rings */
+	ring->sq_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		if(ring->cq_length > ring->sq_length)
+			ring->sq_length = ring->cq_length;
+		ring->cq_length = 0;
+	}
+	ring->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->cq_length ? mmap(NULL, ring->cq_length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+		IORING_OFF_CQ_RING) : ring->sq_ring;
+	ring->sqes = mmap(NULL, ring->sqes_length, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+	if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED){
+		ring_free(ring);
+		return -1;
+	}
+
+	uint8_t* sq = ring->sq_ring;
+	uint8_t* cq = ring->cq_ring;
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = cq + params.cq_off.cqes;
+	ring->tail = *ring->sq_tail;
+	return 0;
+}
+
+/* Opening, reading and closing through the ring came with Linux 5.6 */
+int ring_supported(int fd){
+	static const uint8_t needed[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+	size_t length = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* probe = calloc(1, length);
+	int supported = probe && syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+	for(size_t i = 0; supported && i < sizeof(needed); i++)
+		supported = needed[i] <= probe->last_op && needed[i] < probe->ops_len &&
+			(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return supported;
+}
+
+void ring_free(ReadRing* ring){
+	if(ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_length);
+	if(ring->cq_length && ring->cq_ring && ring->cq_ring != MAP_FAILED)
+		munmap(ring->cq_ring, ring->cq_length);
+	if(ring->sq_ring && ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_length);
+	if(ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, 0, sizeof(ReadRing));
+	ring->fd = -1;
+}
+
+/* Next submission entry, the kernel sees it on the next ring_enter */
+struct io_uring_sqe* ring_entry(ReadRing* ring, uint8_t opcode, int fd, ReadRequest* request, int stage){
+	unsigned index = ring->tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe = (struct io_uring_sqe*)ring->sqes + index;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = (uint64_t)(uintptr_t)request | (uint64_t)stage;
+	ring->sq_array[index] = index;
+	ring->tail++;
+	ring->pending++;
+	return sqe;
+}
+
+/* Submit what was prepared, waiting for a completion when asked to */
+int ring_enter(ReadRing* ring, unsigned wait){
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+	for(;;){
+		long submitted = syscall(SYS_io_uring_enter, ring->fd, ring->pending, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if(submitted < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+			continue;
+		if(submitted < 0)
+			return -1;
+		ring->pending -= (unsigned)submitted;
+		if(ring->pending == 0)
+			return 0;
+	}
+}
+
+/* Advance a request by one stage, 1 once its descriptor is closed */
+int ring_complete(ReadRing* ring, const struct io_uring_cqe* cqe){
+	ReadRequest* request = (ReadRequest*)(uintptr_t)(cqe->user_data & ~(uint64_t)STAGE_MASK);
+	switch(cqe->user_data & STAGE_MASK){
+		case STAGE_OPEN:
+			if(cqe->res < 0){
+				request->state = READ_MISSED;
+				return 1;
+			}
+			/* The close is hard linked, it runs however the read ends */
+			request->fd = cqe->res;
+			struct io_uring_sqe* sqe = ring_entry(ring, IORING_OP_READ, request->fd, request, STAGE_READ);
+			sqe->addr = (uint64_t)(uintptr_t)request->data;
+			sqe->len = (uint32_t)(request->size + 1);
+			sqe->flags = IOSQE_IO_HARDLINK;
+			ring_entry(ring, IORING_OP_CLOSE, request->fd, request, STAGE_CLOSE);
+			return 0;
+		case STAGE_READ:
+			request->got = cqe->res;
+			return 0;
+		default:
+			request->state = (request->got == (int64_t)request->size) ? READ_DONE : READ_MISSED;
+			return 1;
+	}
+}
+
+/* Keep up to READAHEAD_DEPTH files between open and close, each stage of
+ * every file in flight goes to the kernel in one io_uring_enter */
+void* readahead_ring(void* arg){
+	ReadAhead* ahead = arg;
+	ReadRing* ring = &ahead->ring;
+
+	pthread_mutex_lock(&ahead->lock);
+	for(;;){
+		for(;!ahead->head && ahead->active == 0 && !ahead->finished;)
+			pthread_cond_wait(&ahead->work, &ahead->lock);
+		if(!ahead->head && ahead->active == 0)
+			break;
+
+		unsigned opened = 0;
+		for(;ahead->head && ahead->active < READAHEAD_DEPTH; opened++){
+			ReadRequest* request = ahead->head;
+			ahead->head = request->queued;
+			if(!ahead->head)
+				ahead->tail = NULL;
+			ahead->active++;
+			struct io_uring_sqe* sqe = ring_entry(ring, IORING_OP_OPENAT, AT_FDCWD, request, STAGE_OPEN);
+			sqe->addr = (uint64_t)(uintptr_t)request->path;
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		}
+		pthread_mutex_unlock(&ahead->lock);
+
+		/* Block only when nothing new went in, new opens may already be done */
+		if(ring_enter(ring, opened == 0) != 0)
+			printErr("%d: Error: io_uring submission failed: %s\n", __LINE__ - 1, strerror(errno));
+
+		pthread_mutex_lock(&ahead->lock);
+		int finished = 0;
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for(;head != tail; head++)
+			finished += ring_complete(ring, (const struct io_uring_cqe*)ring->cqes + (head & *ring->cq_mask));
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		ahead->active -= finished;
+		if(finished)
+			pthread_cond_broadcast(&ahead->done);
+	}
+	pthread_mutex_unlock(&ahead->lock);
+	return NULL;
+}
+#endif
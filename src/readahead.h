@@ -0,0 +1,87 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "lib.h"
+#include "mapfile.h"
+
+/* defines */
+#define READAHEAD_LIMIT (64UL << 10)   /* files up to this size are read whole ahead of the coder */
+#define READAHEAD_DEPTH 64             /* files in flight, and the serial lookahead */
+#define READAHEAD_THREADS 4            /* blocking readers when io_uring is missing */
+
+/* Read states */
+#define READ_IDLE 0               /* not read ahead, the consumer opens the file */
+#define READ_QUEUED 1
+#define READ_DONE 2               /* data holds exactly the walked size */
+#define READ_MISSED 3             /* failed or changed size, the consumer opens it again */
+
+typedef struct ReadAhead ReadAhead;
+
+/* One file read ahead, owned by the job that submitted it */
+typedef struct ReadRequest {
+	const char* path;
+	uint64_t size;            /* size seen by the walk */
+	uint8_t* data;            /* size + 1 bytes, a full read means the file grew */
+	int64_t got;              /* bytes read */
+	int fd;
+	int state;                /* READ_* */
+	ReadAhead* ahead;
+	struct ReadRequest* queued;   /* next in the submit queue */
+} ReadRequest;
+
+/* Submission and completion rings of an io_uring, mapped from the kernel */
+typedef struct {
+	int fd;                   /* -1 when the reader threads do the work */
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	void* sqes;
+	void* cqes;
+	void* sq_ring;
+	size_t sq_length;
+	void* cq_ring;
+	size_t cq_length;
+	size_t sqes_length;
+	unsigned tail;            /* next free entry, published on submit */
+	unsigned pending;         /* entries prepared, not yet submitted */
+} ReadRing;
+
+/* Open, read and close of small files kept in flight ahead of the coder,
+ * batched through io_uring or spread over a few blocking threads */
+struct ReadAhead {
+	ReadRing ring;
+	pthread_t* readers;
+	int reader_count;
+	pthread_mutex_t lock;
+	pthread_cond_t work;      /* a request was queued or the run ended */
+	pthread_cond_t done;      /* a request completed */
+	ReadRequest* head;        /* submit queue */
+	ReadRequest* tail;
+	int active;               /* requests handed to the ring */
+	int finished;
+};
+
+/* Function declarations */
+int readahead_start(ReadAhead* ahead);
+void readahead_stop(ReadAhead* ahead);
+int readahead_submit(ReadAhead* ahead, ReadRequest* request, const char* path, uint64_t size);
+int readahead_wait(ReadRequest* request, MappedFile* source);
+
+#endif
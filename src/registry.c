@@ -0,0 +1,112 @@
+#include "codec.h"
+
+static size_t ppm_block_compress(const uint8_t* input, size_t raw, int order, int mem_shift, uint8_t* output,
+	size_t capacity);
+static int ppm_block_decompress(const uint8_t* packed, size_t length, uint8_t* output, size_t raw, int order,
+	int mem_shift);
+static size_t fast_block_compress(const uint8_t* input, size_t raw, int order, int mem_shift, uint8_t* output,
+	size_t capacity);
+static int fast_block_decompress(const uint8_t* packed, size_t length, uint8_t* output, size_t raw, int order,
+	int mem_shift);
+static size_t block_bound(size_t raw);
+static int rle_member(FILE* archive, uint64_t packed_size, MemberSink* output, int threads, const Cipher* cipher,
+	uint32_t* checksum);
+
+/* Member coders by FileHeader.algorithm, block coders also by their record tag */
+static const Codec codecs[] = {
+	{ALGO_RLE, 0, "RLE", NULL, NULL, NULL, rle_member},
+	{ALGO_PPM, BLOCK_CODEC_PPM, "PPM", ppm_block_compress, ppm_block_decompress, block_bound, decompress_parallel},
+	{ALGO_LINK, 0, "LINK", NULL, NULL, NULL, NULL},
+	{ALGO_FAST, BLOCK_CODEC_FAST, "FAST", fast_block_compress, fast_block_decompress, block_bound, decompress_parallel},
+};
+
+/* 0 if the block doesn't shrink, encode_block keeps noise away from the model */
+size_t ppm_block_compress(const uint8_t* input, size_t raw, int order, int mem_shift, uint8_t* output,
+	size_t capacity){
+	PPMModel model;
+	if(ppm_model_init(&model, order, (size_t)1 << mem_shift) != 0)
+		return 0;
+	if(capacity >= raw)
+		capacity = raw - 1;
+	size_t coded = ppm_encode(&model, input, raw, output, capacity);
+	ppm_model_free(&model);
+	return coded;
+}
+
+int ppm_block_decompress(const uint8_t* packed, size_t length, uint8_t* output, size_t raw, int order,
+	int mem_shift){
+	PPMModel model;
+	if(ppm_model_init(&model, order, (size_t)1 << mem_shift) != 0)
+		return -1;
+	size_t decoded = ppm_decode(&model, packed, length, output, raw);
+	ppm_model_free(&model);
+	return (decoded == raw) ? 0 : -1;
+}
+
+/* The run scan is as quick as sampling, no estimate needed */
+size_t fast_block_compress(const uint8_t* input, size_t raw, int order, int mem_shift, uint8_t* output,
+	size_t capacity){
+	(void)order;
+	(void)mem_shift;
+	return fast_encode(input, raw, output, capacity < raw ? capacity : raw - 1);
+}
+
+int fast_block_decompress(const uint8_t* packed, size_t length, uint8_t* output, size_t raw, int order,
+	int mem_shift){
+	(void)order;
+	(void)mem_shift;
+	return fast_decode(packed, length, output, raw);
+}
+
+/* Both coders give up rather than grow a block */
+size_t block_bound(size_t raw){
+	return raw;
+}
+
+/* Older than encryption, never part of a password archive */
+int rle_member(FILE* archive, uint64_t packed_size, MemberSink* output, int threads, const Cipher* cipher,
+	uint32_t* checksum){
+	(void)threads;
+	if(cipher)
+		return -1;
+	return rle_decompress_member(archive, packed_size, output, checksum);
+}
+
+/* Coder a member was written with, NULL for an unknown byte */
+const Codec* codec_find(uint8_t algorithm){
+	for(size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+		if(codecs[i].algorithm == algorithm)
+			return &codecs[i];
+	return NULL;
+}
+
+/* Block coder named by the top byte of a record's packed length */
+const Codec* codec_block(uint32_t tag){
+	for(size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+		if(codecs[i].decompress && codecs[i].block_tag == tag)
+			return &codecs[i];
+	return NULL;
+}
+
+/* Level 1 is the run coder, 2 to LEVEL_ORDER_TOP PPM with one more byte
+ * of context each, higher levels more model memory, see member_mem_shift.
+ * NULL for level 0 which stores */
+const Codec* codec_level(int level, int* order){
+	if(order)
+		*order = PPM_DEFAULT_ORDER;
+	if(level <= LEVEL_STORE)
+		return NULL;
+	if(level == LEVEL_FAST)
+		return codec_find(ALGO_FAST);
+
+	if(order)
+		*order = ((level < LEVEL_ORDER_TOP) ? level : LEVEL_ORDER_TOP) - 1;
+	return codec_find(ALGO_PPM);
+}
+
+/* Record buffer for raw bytes at a level, stored and encrypted blocks included */
+size_t record_bound(int level, size_t raw){
+	const Codec* codec = codec_level(level, NULL);
+	size_t bound = codec ? codec->bound(raw) : raw;
+	return BLOCK_HEADER_SIZE + (bound > raw ? bound : raw) + CIPHER_OVERHEAD;
+}
@@ -0,0 +1,26 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* defines */
+#define SHA256_SIZE 32
+#define SHA256_BLOCK 64
+
+/* Streaming state */
+typedef struct {
+	uint32_t state[8];
+	uint64_t length;          /* bytes hashed so far */
+	uint8_t buffer[SHA256_BLOCK];
+	size_t used;
+} Sha256;
+
+/* Function declarations */
+void sha256_init(Sha256* ctx);
+void sha256_update(Sha256* ctx, const uint8_t* data, size_t length);
+void sha256_final(Sha256* ctx, uint8_t digest[SHA256_SIZE]);
+void sha256(const uint8_t* data, size_t length, uint8_t digest[SHA256_SIZE]);
+
+#endif
@@ -0,0 +1,80 @@
+#include "stats.h"
+
+static uint64_t now(void);
+static void stats_report(void);
+
+static const char* phase_names[STAT_PHASES] = {
+	"walk", "read", "hash", "compress", "write", "decode", "index", "sync", "cipher"
+};
+static const char* counter_names[STAT_COUNTERS] = {
+	"files", "directories", "bytes_in", "bytes_out", "compressed", "stored", "linked", "skipped", "failed",
+	"unchanged", "stored_blocks", "run_blocks"
+};
+
+/* Written by all threads with atomic adds, read once at exit */
+static int stats_mode = 0;
+static const char* stats_operation = "";
+static uint64_t stats_start = 0;
+static uint64_t phase_ns[STAT_PHASES];
+static uint64_t counters[STAT_COUNTERS];
+
+uint64_t now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Collect from here on, the summary is printed when the process exits */
+void stats_enable(int mode, const char* operation){
+	stats_mode = mode;
+	stats_operation = operation;
+	stats_start = now();
+	atexit(stats_report);
+}
+
+/* Start of a timed phase, 0 and no clock read when disabled */
+uint64_t stats_clock(void){
+	return stats_mode ? now() : 0;
+}
+
+void stats_time(int phase, uint64_t start){
+	if(stats_mode)
+		__atomic_fetch_add(&phase_ns[phase], now() - start, __ATOMIC_RELAXED);
+}
+
+void stats_count(int counter, uint64_t value){
+	if(stats_mode)
+		__atomic_fetch_add(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+/* Summary on stderr, command output on stdout stays parseable */
+void stats_report(void){
+	double wall = (double)(now() - stats_start) / 1e9;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	double cpu = (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+		(double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	double mb_s = wall > 0 ? (double)counters[STAT_BYTES_IN] / 1048576.0 / wall : 0;
+
+	if(stats_mode == STATS_JSON){
+		fprintf(stderr, "{\"operation\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, "
+			"\"peak_rss_kb\": %ld, \"mb_s\": %.2f, \"phases\": {", stats_operation, wall, cpu, usage.ru_maxrss, mb_s);
+		for(int i = 0; i < STAT_PHASES; i++)
+			fprintf(stderr, "%s\"%s\": %.6f", i ? ", " : "", phase_names[i], (double)phase_ns[i] / 1e9);
+		fprintf(stderr, "}, \"counters\": {");
+		for(int i = 0; i < STAT_COUNTERS; i++)
+			fprintf(stderr, "%s\"%s\": %llu", i ? ", " : "", counter_names[i], (unsigned long long)counters[i]);
+		fprintf(stderr, "}}\n");
+		return;
+	}
+
+	fprintf(stderr, "\nStatistics (%s):\n", stats_operation);
+	fprintf(stderr, "  wall %.3f s, cpu %.3f s, peak RSS %ld KiB, %.2f MB/s\n", wall, cpu, usage.ru_maxrss, mb_s);
+	fprintf(stderr, "  phases, thread seconds:\n");
+	for(int i = 0; i < STAT_PHASES; i++)
+		if(phase_ns[i])
+			fprintf(stderr, "    %-10s %10.3f\n", phase_names[i], (double)phase_ns[i] / 1e9);
+	fprintf(stderr, "  counters:\n");
+	for(int i = 0; i < STAT_COUNTERS; i++)
+		fprintf(stderr, "    %-13s %llu\n", counter_names[i], (unsigned long long)counters[i]);
+}
@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+/* Timed phases, nanoseconds summed over all threads */
+#define STAT_WALK 0               /* readdir and stat */
+#define STAT_READ 1               /* opening and mapping sources or members */
+#define STAT_HASH 2               /* dedup digests */
+#define STAT_COMPRESS 3           /* block coders, entropy sampling included */
+#define STAT_WRITE 4              /* archive or extracted file output */
+#define STAT_DECODE 5             /* block decoders, decryption and checksums */
+#define STAT_INDEX 6              /* central directory */
+#define STAT_SYNC 7               /* flush, truncate and close */
+#define STAT_CIPHER 8             /* record encryption */
+#define STAT_PHASES 9
+
+/* Counters */
+#define STAT_FILES 0              /* members seen */
+#define STAT_DIRS 1
+#define STAT_BYTES_IN 2           /* original bytes read or produced */
+#define STAT_BYTES_OUT 3          /* archive payload bytes */
+#define STAT_COMPRESSED 4
+#define STAT_STORED 5
+#define STAT_LINKED 6             /* dedup links */
+#define STAT_SKIPPED 7
+#define STAT_FAILED 8
+#define STAT_UNCHANGED 9          /* members an update kept in place */
+#define STAT_BLOCKS_STORED 10     /* frame blocks left as they were */
+#define STAT_BLOCKS_RUNS 11       /* blocks a PPM level gave to the run coder */
+#define STAT_COUNTERS 12
+
+/* stats_enable modes */
+#define STATS_TEXT 1
+#define STATS_JSON 2
+
+/* Function declarations */
+void stats_enable(int mode, const char* operation);
+uint64_t stats_clock(void);
+void stats_time(int phase, uint64_t start);
+void stats_count(int counter, uint64_t value);
+
+#endif
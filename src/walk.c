@@ -0,0 +1,331 @@
+#include "walk.h"
+
+static void* walk_scanner(void* arg);
+static void walk_scan(Walker* walker, WalkDir* dir);
+static int walk_open(Walker* walker, WalkDir* dir);
+static int walk_list(int fd, WalkDir* dir);
+static int walk_add(WalkDir* dir, const char* name, uint64_t inode, unsigned char type);
+static size_t walk_classify(int fd, WalkDir* dir);
+static void walk_unqueue(Walker* walker, WalkDir* dir);
+static void walk_dir(Walker* walker, WalkDir* dir, WalkVisit visit, void* arg);
+static void walk_free(WalkDir* dir);
+static int entry_compare(const void* a, const void* b);
+
+#ifdef SYS_getdents64
+/* Record layout of getdents64 */
+struct walk_dirent {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#endif
+
+/* Walk base_path, calling visit for every regular file. Scanner threads list
+ * and stat directories ahead, the calling thread visits in depth-first order */
+void walk_tree(const char* base_path, int threads, WalkVisit visit, void* arg){
+	Walker walker;
+	memset(&walker, 0, sizeof(Walker));
+	walker.base_path = base_path;
+
+	/* Whatever the walk keeps open leaves room for the pipeline's files */
+	struct rlimit limit;
+	walker.fd_budget = WALK_FD_MAX;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+		limit.rlim_cur / WALK_FD_SHARE < walker.fd_budget)
+		walker.fd_budget = (size_t)(limit.rlim_cur / WALK_FD_SHARE);
+	pthread_mutex_init(&walker.lock, NULL);
+	pthread_cond_init(&walker.work, NULL);
+	pthread_cond_init(&walker.ready, NULL);
+
+	WalkDir* root = calloc(1, sizeof(WalkDir));
+	if(!root || !(root->rel_path = strdup("")))
+		printErr("%d: Error: Out of memory\n", __LINE__ - 1);
+	root->fd = -1;
+
+	/* A single thread lists every directory itself when it gets there */
+	if(threads > 1 && (walker.scanners = calloc((size_t)threads, sizeof(pthread_t)))){
+		for(;walker.threads < threads &&
+			pthread_create(&walker.scanners[walker.threads], NULL, walk_scanner, &walker) == 0; walker.threads++);
+		walker.ahead_limit = (size_t)walker.threads * WALK_AHEAD_PER_THREAD;
+		/* Every directory listed ahead may hold an fd until it is consumed */
+		if(walker.ahead_limit > walker.fd_budget / 2)
+			walker.ahead_limit = walker.fd_budget / 2;
+	}
+
+	walk_dir(&walker, root, visit, arg);
+
+	pthread_mutex_lock(&walker.lock);
+	walker.finished = 1;
+	pthread_cond_broadcast(&walker.work);
+	pthread_mutex_unlock(&walker.lock);
+	for(int i = 0; i < walker.threads; i++)
+		pthread_join(walker.scanners[i], NULL);
+
+	free(walker.scanners);
+	pthread_mutex_destroy(&walker.lock);
+	pthread_cond_destroy(&walker.work);
+	pthread_cond_destroy(&walker.ready);
+}
+
+/* List queued directories until the walk ends */
+void* walk_scanner(void* arg){
+	Walker* walker = arg;
+	pthread_mutex_lock(&walker->lock);
+	for(;;){
+		for(;!walker->head && !walker->finished;)
+			pthread_cond_wait(&walker->work, &walker->lock);
+		if(!walker->head)
+			break;
+
+		WalkDir* dir = walker->head;
+		walker->head = dir->queued;
+		if(!walker->head)
+			walker->tail = NULL;
+		dir->state = WALK_SCANNING;
+		pthread_mutex_unlock(&walker->lock);
+
+		walk_scan(walker, dir);
+		pthread_mutex_lock(&walker->lock);
+	}
+	pthread_mutex_unlock(&walker->lock);
+	return NULL;
+}
+
+/* List one directory, then queue its subdirectories while there is room */
+void walk_scan(Walker* walker, WalkDir* dir){
+	uint64_t clock = stats_clock();
+	size_t subdirs = 0;
+	int fd = walk_open(walker, dir);
+	if(fd < 0)
+		dir->error = errno;
+	else if(walk_list(fd, dir) != 0)
+		dir->error = errno ? errno : ENOMEM;
+	else {
+		/* Inode order keeps the stats, and later the reads, close together on disk */
+		qsort(dir->entries, dir->count, sizeof(WalkEntry), entry_compare);
+		subdirs = walk_classify(fd, dir);
+	}
+	stats_count(STAT_DIRS, 1);
+	stats_time(STAT_WALK, clock);
+
+	/* The fd is kept for the subdirectories while the budget allows */
+	pthread_mutex_lock(&walker->lock);
+	if(fd >= 0 && subdirs > 0 && walker->fds_held < walker->fd_budget){
+		dir->fd = fd;
+		walker->fds_held++;
+	} else if(fd >= 0)
+		close(fd);
+	for(size_t i = 0; i < dir->count && walker->ahead < walker->ahead_limit; i++){
+		WalkDir* child = dir->entries[i].dir;
+		if(dir->entries[i].kind != WALK_DIR || child->state != WALK_NEW)
+			continue;
+		child->state = WALK_QUEUED;
+		child->prefetched = 1;
+		if(walker->tail)
+			walker->tail->queued = child;
+		else
+			walker->head = child;
+		walker->tail = child;
+		walker->ahead++;
+		pthread_cond_signal(&walker->work);
+	}
+	dir->state = WALK_READY;
+	pthread_cond_broadcast(&walker->ready);
+	pthread_mutex_unlock(&walker->lock);
+}
+
+/* Open a directory relative to its nearest ancestor still holding an fd,
+ * by name when that is the parent, so no path is looked up from the base.
+ * Ancestors stay until all their descendants are consumed */
+int walk_open(Walker* walker, WalkDir* dir){
+	WalkDir* ancestor = dir->parent;
+	for(;ancestor && ancestor->fd < 0; ancestor = ancestor->parent);
+	if(ancestor)
+		return openat(ancestor->fd, dir->rel_path + strlen(ancestor->rel_path) + (ancestor->rel_path[0] != 0),
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	char path[PATH_MAX*2];
+	snprintf(path, sizeof(path), "%s%s%s", walker->base_path, dir->rel_path[0] ? "/" : "", dir->rel_path);
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Names, inodes and d_type of a directory, . and .. left out */
+int walk_list(int fd, WalkDir* dir){
+#ifdef SYS_getdents64
+	uint64_t buffer[WALK_BUFFER / sizeof(uint64_t)];
+	for(;;){
+		long got = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+		if(got <= 0)
+			return (got == 0) ? 0 : -1;
+		for(long at = 0; at < got;){
+			const struct walk_dirent* entry = (const struct walk_dirent*)((const char*)buffer + at);
+			at += entry->d_reclen;
+			if(walk_add(dir, entry->d_name, entry->d_ino, entry->d_type) != 0)
+				return -1;
+		}
+	}
+#else
+	int copy = dup(fd);
+	DIR* stream = (copy >= 0) ? fdopendir(copy) : NULL;
+	if(!stream){
+		if(copy >= 0)
+			close(copy);
+		return -1;
+	}
+	struct dirent* entry;
+	int status = 0;
+	for(;status == 0 && (entry = readdir(stream)) != NULL;)
+		status = walk_add(dir, entry->d_name, entry->d_ino, DT_UNKNOWN);
+	closedir(stream);
+	return status;
+#endif
+}
+
+int walk_add(WalkDir* dir, const char* name, uint64_t inode, unsigned char type){
+	if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return 0;
+
+	size_t length = strlen(name) + 1;
+	if(dir->count == dir->capacity){
+		size_t capacity = dir->capacity ? dir->capacity * 2 : 64;
+		WalkEntry* entries = realloc(dir->entries, capacity * sizeof(WalkEntry));
+		if(!entries)
+			return -1;
+		dir->entries = entries;
+		dir->capacity = capacity;
+	}
+	if(dir->names_used + length > dir->names_capacity){
+		size_t capacity = dir->names_capacity ? dir->names_capacity * 2 : BUFFER;
+		for(;capacity < dir->names_used + length; capacity *= 2);
+		char* names = realloc(dir->names, capacity);
+		if(!names)
+			return -1;
+		dir->names = names;
+		dir->names_capacity = capacity;
+	}
+
+	/* d_type is parked in kind until walk_classify */
+	WalkEntry* entry = &dir->entries[dir->count++];
+	memset(entry, 0, sizeof(WalkEntry));
+	entry->name = dir->names_used;
+	entry->inode = inode;
+	entry->kind = type;
+	memcpy(dir->names + dir->names_used, name, length);
+	dir->names_used += length;
+	return 0;
+}
+
+/* Directories are known from d_type alone, anything else is stat'ed
+ * relative to the open directory, symlinks followed as stat() did.
+ * Returns the number of subdirectories */
+size_t walk_classify(int fd, WalkDir* dir){
+	size_t subdirs = 0;
+	for(size_t i = 0; i < dir->count; i++){
+		WalkEntry* entry = &dir->entries[i];
+		const char* name = dir->names + entry->name;
+		if(entry->kind != DT_DIR && fstatat(fd, name, &entry->stat_buf, 0) != 0){
+			entry->kind = WALK_FAILED;
+			entry->error = errno;
+			continue;
+		}
+
+		if(entry->kind == DT_DIR || S_ISDIR(entry->stat_buf.st_mode)){
+			entry->kind = WALK_DIR;
+			entry->dir = calloc(1, sizeof(WalkDir));
+			size_t length = strlen(dir->rel_path) + strlen(name) + 2;
+			if(!entry->dir || !(entry->dir->rel_path = malloc(length)))
+				printErr("%d: Error: Out of memory\n", __LINE__ - 1);
+			snprintf(entry->dir->rel_path, length, "%s%s%s", dir->rel_path, dir->rel_path[0] ? "/" : "", name);
+			entry->dir->parent = dir;
+			entry->dir->name = name;
+			entry->dir->fd = -1;
+			subdirs++;
+		} else
+			entry->kind = S_ISREG(entry->stat_buf.st_mode) ? WALK_FILE : WALK_OTHER;
+	}
+	return subdirs;
+}
+
+/* Take a directory back from the scan queue */
+void walk_unqueue(Walker* walker, WalkDir* dir){
+	WalkDir* previous = NULL;
+	for(WalkDir* at = walker->head; at; previous = at, at = at->queued){
+		if(at != dir)
+			continue;
+		if(previous)
+			previous->queued = dir->queued;
+		else
+			walker->head = dir->queued;
+		if(walker->tail == dir)
+			walker->tail = previous;
+		return;
+	}
+}
+
+/* Visit a directory in order, listing it here if no scanner got to it yet */
+void walk_dir(Walker* walker, WalkDir* dir, WalkVisit visit, void* arg){
+	pthread_mutex_lock(&walker->lock);
+	int scan_here = (dir->state == WALK_NEW || dir->state == WALK_QUEUED);
+	if(dir->state == WALK_QUEUED)
+		walk_unqueue(walker, dir);
+	if(dir->prefetched)
+		walker->ahead--;
+	if(scan_here)
+		dir->state = WALK_SCANNING;
+	for(;!scan_here && dir->state != WALK_READY;)
+		pthread_cond_wait(&walker->ready, &walker->lock);
+	pthread_mutex_unlock(&walker->lock);
+	if(scan_here)
+		walk_scan(walker, dir);
+
+	if(dir->error)
+		printErr("%d: Warning: Cannot open directory %s/%s: %s\n", __LINE__, walker->base_path, dir->rel_path,
+			strerror(dir->error));
+
+	for(size_t i = 0; i < dir->count; i++){
+		WalkEntry* entry = &dir->entries[i];
+		if(entry->kind == WALK_DIR){
+			walk_dir(walker, entry->dir, visit, arg);
+			continue;
+		}
+
+		/* Build relative and full path */
+		char rel_path[PATH_MAX];
+		char full_path[PATH_MAX*2];
+		const char* name = dir->names + entry->name;
+		snprintf(rel_path, sizeof(rel_path), "%s%s%s", dir->rel_path, dir->rel_path[0] ? "/" : "", name);
+		snprintf(full_path, sizeof(full_path), "%s/%s", walker->base_path, rel_path);
+
+		if(entry->kind == WALK_FAILED)
+			fprintf(stderr, "%d: Warning: Cannot stat %s: %s\n", __LINE__ - 1, full_path, strerror(entry->error));
+		else if(entry->kind == WALK_OTHER)
+			printErr("%d: Error: %s is not a regular file or directory\n", __LINE__ - 3, full_path);
+		else
+			visit(full_path, rel_path, &entry->stat_buf, arg);
+	}
+	if(dir->fd >= 0){
+		close(dir->fd);
+		pthread_mutex_lock(&walker->lock);
+		walker->fds_held--;
+		pthread_mutex_unlock(&walker->lock);
+	}
+	walk_free(dir);
+}
+
+void walk_free(WalkDir* dir){
+	free(dir->entries);
+	free(dir->names);
+	free(dir->rel_path);
+	free(dir);
+}
+
+/* Inode order, ties (hard links) in listing order */
+int entry_compare(const void* a, const void* b){
+	const WalkEntry* x = a;
+	const WalkEntry* y = b;
+	if(x->inode != y->inode)
+		return (x->inode < y->inode) ? -1 : 1;
+	return (x->name < y->name) ? -1 : (x->name > y->name);
+}
@@ -0,0 +1,97 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "lib.h"
+#include "stats.h"
+
+/* defines */
+#define WALK_BUFFER (1 << 15)     /* getdents64 batch */
+#define WALK_AHEAD_PER_THREAD 64  /* directories listed ahead of the consumer */
+#define WALK_FD_SHARE 4           /* directory fds held open, at most RLIMIT_NOFILE / this */
+#define WALK_FD_MAX 4096
+
+/* Entry kinds */
+#define WALK_FILE 0
+#define WALK_DIR 1
+#define WALK_OTHER 2              /* device, fifo or socket */
+#define WALK_FAILED 3             /* stat failed, error says why */
+
+/* Directory states */
+#define WALK_NEW 0
+#define WALK_QUEUED 1
+#define WALK_SCANNING 2
+#define WALK_READY 3
+
+typedef struct WalkDir WalkDir;
+
+/* Directory entry as a scanner found it */
+typedef struct {
+	size_t name;              /* offset in the directory's name buffer */
+	uint64_t inode;
+	int kind;                 /* WALK_* */
+	int error;                /* errno of a failed stat */
+	struct stat stat_buf;     /* files only */
+	WalkDir* dir;             /* node of a subdirectory */
+} WalkEntry;
+
+/* Directory listed by a scanner thread or by the consumer itself */
+struct WalkDir {
+	char* rel_path;
+	WalkDir* parent;
+	const char* name;         /* in the parent's name buffer, opened relative to parent->fd */
+	int fd;                   /* kept from the scan until consumed while it has subdirectories
+	                           * and the fd budget allows, else -1 */
+	int state;                /* WALK_NEW .. WALK_READY */
+	int error;                /* errno when the directory could not be opened */
+	WalkEntry* entries;       /* in inode order */
+	size_t count;
+	size_t capacity;
+	char* names;              /* all entry names, NUL separated */
+	size_t names_used;
+	size_t names_capacity;
+	int prefetched;           /* queued for a scanner, counts in Walker.ahead */
+	WalkDir* queued;          /* next in the scan queue */
+};
+
+/* Files are handed over in a fixed depth-first order while scanners list
+ * directories ahead of it, so the output doesn't depend on thread timing */
+typedef struct {
+	const char* base_path;
+	int threads;
+	pthread_t* scanners;
+	pthread_mutex_t lock;
+	pthread_cond_t work;      /* a directory was queued or the walk ended */
+	pthread_cond_t ready;     /* a directory was listed */
+	WalkDir* head;            /* scan queue */
+	WalkDir* tail;
+	size_t ahead;             /* directories queued or listed, not consumed */
+	size_t ahead_limit;
+	size_t fds_held;          /* directory fds kept for children */
+	size_t fd_budget;
+	int finished;
+} Walker;
+
+/* Called for every regular file, in walk order */
+typedef void (*WalkVisit)(const char* filepath, const char* rel_path, struct stat* stat_buf, void* arg);
+
+/* Function declarations */
+void walk_tree(const char* base_path, int threads, WalkVisit visit, void* arg);
+
+#endif
@@ -3,6 +3,8 @@
 static int print_usage(const char* program_name);
 static int print_version();
 static int show_archive_info(const char* archive_path);
+static int parse_options(int* argc, char* argv[], int* threads, int* level, int* stats, int* hash, int* password);
+static char* read_password(int confirm);
 
 /* Print usage information */
 int print_usage(const char* program_name){
@@ -12,13 +14,26 @@ int print_usage(const char* program_name){
 	fprintf(stdout, "Commands:\n");
 	fprintf(stdout, "  c <archive>  <directory>    Create archive from directory\n");
 	fprintf(stdout, "  x <archive>  <directory>    Extract archive to directory\n");
+	fprintf(stdout, "  x <archive>  <directory> <path|glob>...  Extract only matching members\n");
+	fprintf(stdout, "  c - <directory> | x - <directory>  Write the archive to stdout, read it from stdin\n");
+	fprintf(stdout, "  u <archive>  <directory>    Update archive, only new and changed files are compressed\n");
+	fprintf(stdout, "                              and rebuilt once a quarter of it is replaced or deleted data\n");
 	fprintf(stdout, "  l <archive>                   List archive contents\n");
 	fprintf(stdout, "  e <archive>                 Verify archive integrity\n");
 	fprintf(stdout, "  i <archive>                   Show archive information\n\n");
+	fprintf(stdout, "  f                           Fast level: run-length blocks, larger archive\n");
 	fprintf(stdout, "  v 	                   	Verbose\n\n");
 	fprintf(stdout, "  V, --version	                   Show version information\n\n");
 	fprintf(stdout, "Options:\n");
 	fprintf(stdout, "  h	                      Show this help message\n");
+	fprintf(stdout, "  -j, --threads <n>           Worker threads (default: online CPUs)\n");
+	fprintf(stdout, "  -l, --level <0-9>           0 stores, 1 is f, 2-%d PPM with longer contexts, then more memory\n",
+		LEVEL_ORDER_TOP);
+	fprintf(stdout, "                              (default: %d)\n", LEVEL_DEFAULT);
+	fprintf(stdout, "  --hash                      u also compares contents, not only size and mtime\n");
+	fprintf(stdout, "  --password                  Encrypt on c, needed by x, e and u of a password archive;\n");
+	fprintf(stdout, "                              taken from %s when set, asked for otherwise\n", PASSWORD_ENV);
+	fprintf(stdout, "  --stats[=json]              Phase timings and counters on stderr when done\n");
 	fprintf(stdout, "Examples:\n");
 	exit(0);
 }
@@ -34,51 +49,134 @@ int print_version(){
 
 /* Show detailed archive information */
 int show_archive_info(const char* archive_path){
-	FILE* archive = fopen(archive_path, "rb");
-	if(!archive)
-		printErr("%d: Error: Cannot open archive %s\n", __LINE__ - 2, archive_path);
-
-	long int archive_size = getFileSize(archive);
-	if(archive_size < (long)sizeof(ArchiveHeader)){
-		fclose(archive);
-		printErr("%d: Error: File is too small to be a valid archive\n", __LINE__ - 5);
-	}
+	IndexReader reader;
+	index_open(archive_path, &reader);
 
-	ArchiveHeader arch_header;
-	if(fread(&arch_header, sizeof(ArchiveHeader), 1, archive) != 1){
-		fclose(archive);
-		printErr("%d: Error: Cannot read archive header\n", __LINE__ - 2);
+	/* Totals come from the index, payloads are never read */
+	uint64_t original_size = 0, packed_size = 0;
+	ArchiveEntry entry;
+	for(;index_next(&reader, &entry) == 1;){
+		original_size += entry.original_size;
+		packed_size += entry.file_size;
 	}
 
-	if(memcmp(arch_header.magic, MAGIC, 8) != 0){
-		fclose(archive);
-		printErr("%d: Error: Not a valid archive file\n", __LINE__ - 2);
-	}
 	fprintf(stdout, "Archive Information:\n");
 	fprintf(stdout, "====================\n");
 	fprintf(stdout, "File: %s\n", archive_path);
-	fprintf(stdout, "Size: %ld bytes\n", archive_size);
-	fprintf(stdout, "File count: %d\n", arch_header.file_count);
-	fprintf(stdout, "Total archive size: %lu bytes\n", (unsigned long)arch_header.total_size);
-	fprintf(stdout, "Password protected: %s\n", arch_header.has_password ? "yes" : "no");
+	fprintf(stdout, "Size: %lu bytes\n", (unsigned long)reader.archive_size);
+	fprintf(stdout, "File count: %lu\n", (unsigned long)reader.count);
+	fprintf(stdout, "Total archive size: %lu bytes\n", (unsigned long)reader.header.total_size);
+	fprintf(stdout, "Original size: %lu bytes\n", (unsigned long)original_size);
+	fprintf(stdout, "Packed size: %lu bytes\n", (unsigned long)packed_size);
+	fprintf(stdout, "Format: %s\n", reader.header.format == FORMAT_LEGACY ? "legacy" : "packed");
+	fprintf(stdout, "Central directory: %s\n", reader.has_index ? "yes" : "no");
+	fprintf(stdout, "Password protected: %s\n", reader.header.has_password ? "yes" : "no");
 
 	/* Calculate compression ratio if possible */
-	if(archive_size > 0){
-		double ratio = ((double)arch_header.total_size / archive_size) * 100.0;
+	if(original_size > 0)
+		fprintf(stdout, "Compression ratio: %.2f%%\n", ((double)packed_size / original_size) * 100.0);
+	if(reader.archive_size > 0){
+		double ratio = ((double)packed_size / reader.archive_size) * 100.0;
 		fprintf(stdout, "Structure overhead: %.2f%%\n", 100.0f - ratio);
 	}
 
-	fclose(archive);
+	index_close(&reader);
 	exit(0);
 }
 
+/* Pull dash options out of argv, the rest keeps its positions */
+int parse_options(int* argc, char* argv[], int* threads, int* level, int* stats, int* hash, int* password){
+	int kept = 1;
+	for(int i = 1; i < *argc; i++){
+		const char* value = NULL;
+		int is_level = 0;
+		if(strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0){
+			*stats = STATS_TEXT;
+			continue;
+		}
+		if(strcmp(argv[i], "--stats=json") == 0){
+			*stats = STATS_JSON;
+			continue;
+		}
+		if(strcmp(argv[i], "--hash") == 0){
+			*hash = 1;
+			continue;
+		}
+		if(strcmp(argv[i], "--password") == 0){
+			*password = 1;
+			continue;
+		}
+		if(strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0 ||
+			strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--level") == 0){
+			is_level = strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--level") == 0;
+			if(i + 1 >= *argc)
+				printErr("Error: %s needs a %s\n", argv[i], is_level ? "level" : "thread count");
+			value = argv[++i];
+		} else if(strncmp(argv[i], "--threads=", 10) == 0)
+			value = argv[i] + 10;
+		else if(strncmp(argv[i], "--level=", 8) == 0){
+			value = argv[i] + 8;
+			is_level = 1;
+		} else if(strncmp(argv[i], "-j", 2) == 0)
+			value = argv[i] + 2;
+		else if(strncmp(argv[i], "-l", 2) == 0){
+			value = argv[i] + 2;
+			is_level = 1;
+		} else {
+			argv[kept++] = argv[i];
+			continue;
+		}
+
+		char* end = NULL;
+		long count = strtol(value, &end, 10);
+		if(is_level){
+			if(!end || *end != '\0' || *value == '\0' || count < LEVEL_STORE || count > LEVEL_MAX)
+				printErr("Error: Invalid level '%s', expected %d-%d\n", value, LEVEL_STORE, LEVEL_MAX);
+			*level = (int)count;
+			continue;
+		}
+		if(!end || *end != '\0' || count < 1 || count > MAX_THREADS)
+			printErr("Error: Invalid thread count '%s'\n", value);
+		*threads = (int)count;
+	}
+	argv[kept] = NULL;
+	*argc = kept;
+	return 0;
+}
+
+/* Password from the environment, or asked for on the terminal, twice for a new archive */
+char* read_password(int confirm){
+	const char* value = getenv(PASSWORD_ENV);
+	char* password = strdup(value ? value : getpass("Password: "));
+	if(!value && password && confirm){
+		char* again = strdup(getpass("Repeat password: "));
+		if(!again || strcmp(password, again) != 0)
+			printErr("Error: Passwords do not match\n");
+		memset(again, 0, strlen(again));
+		free(again);
+	}
+	if(!password || password[0] == '\0')
+		printErr("Error: Empty password\n");
+	return password;
+}
+
 /* Main function */
 int main(int argc, char* argv[]) {
 	if(argc == 1){
-		fprintf(stdout, "%s: You must specify one of the 'cxleivV' options.\n \
+		fprintf(stdout, "%s: You must specify one of the 'cxuleivVf' options.\n \
 				Try '%s --help' or '%s h' for more information.\n", argv[0], argv[0], argv[0]);
 		return 0;
 	}
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads < 1)
+		threads = 1;
+	if(threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	int level = LEVEL_DEFAULT, stats = 0, hash = 0, protect = 0;
+	parse_options(&argc, argv, &threads, &level, &stats, &hash, &protect);
+	if(argc == 1)
+		printErr("Usage: zov <flags> <argument> ...\n");
+
 	/* If no arguments, show help */
 	if(strcmp(argv[1], "--help") == 0)
 		print_usage(argv[0]);
@@ -103,6 +201,14 @@ int main(int argc, char* argv[]) {
 				/* list flag */
 				state = 3;
 				break;
+			case 'u':
+				/* update flag */
+				state = 6;
+				break;
+			case 'f':
+				/* fast level, run-length blocks */
+				level = LEVEL_FAST;
+				break;
 			case 'v':
 				/* verbose flag */
 				vflag = 1;
@@ -133,6 +239,10 @@ int main(int argc, char* argv[]) {
 	if(argc <= 2)
 		printErr("Usage: zov <flags> <argument> ...\n");
 
+	static const char* operations[] = {"", "extract", "create", "list", "verify", "info", "update"};
+	if(stats && state > 0)
+		stats_enable(stats, operations[state]);
+
 	char directory[BUFFER] = {0};
 	if(argc <= 3 && state == 1)
 		strcpy(directory, ".");
@@ -141,6 +251,7 @@ int main(int argc, char* argv[]) {
 	else
 		strcpy(directory, argv[3]);
 	const char* archive = argv[2];
+	char* password = (protect && state > 0 && state != 3 && state != 5) ? read_password(state == 2) : NULL;
 
 	/* Handle archive commands */
 	switch(state){
@@ -152,7 +263,9 @@ int main(int argc, char* argv[]) {
 			if(vflag == 1)
 				fprintf(stdout, "Extracting archive: %s to directory %s\n", archive, directory);
 			
-			if(extract_archive(archive, directory, NULL, vflag) != 0)
+			/* Anything after the directory selects members by name or glob */
+			if(extract_archive(archive, directory, password, vflag, threads,
+				argc > 4 ? argv + 4 : NULL, argc > 4 ? argc - 4 : 0) != 0)
 				printErr("%d: Error: Failed to extract archive\n", __LINE__);
 			
 			
@@ -164,11 +277,12 @@ int main(int argc, char* argv[]) {
 				printErr("%d: Error: Missing arguments for create command\n \
 					Usage: %s c <directory> <archive>\n", __LINE__, argv[0]);
 			
+			/* c - puts the archive itself on stdout */
 			if(vflag == 1)
-				fprintf(stdout, "Creating archive '%s' from directory '%s'\n  \
+				fprintf(strcmp(archive, STREAM_PATH) ? stdout : stderr, "Creating archive '%s' from directory '%s'\n  \
 					Using PPM compression algorithm...\n", archive, directory);
 			
-			if(create_archive(directory, archive, NULL, vflag) != 0)
+			if(create_archive(directory, archive, password, vflag, threads, level) != 0)
 				printErr("%d: Error: Failed to create archive\n", __LINE__ - 1);
 			
 			if(vflag == 1)
@@ -187,7 +301,7 @@ int main(int argc, char* argv[]) {
 				printErr("%d: Error: Missing archive file for verify command\n \
 				Usage: %s e <archive>\n", __LINE__, argv[0]);
 		
-			if(verify_archive(argv[2]) != 0)
+			if(verify_archive(argv[2], password, threads) != 0)
 				printErr("%d: Archive verification failed!\n", __LINE__);
 			break;
         
@@ -199,8 +313,17 @@ int main(int argc, char* argv[]) {
 			show_archive_info(argv[2]);
 			break;
 		
+		case 6:
+			if(argc < 4)
+				printErr("%d: Error: Missing arguments for update command\n \
+					Usage: %s u <archive> <directory>\n", __LINE__, argv[0]);
+
+			if(update_archive(directory, archive, password, vflag, threads, level, hash) != 0)
+				printErr("%d: Error: Failed to update archive\n", __LINE__ - 1);
+			break;
+
 		default:
-			printErr("Error: Unknown command \'%s\'");
+			printErr("Error: Unknown command \'%s\'\n", argv[1]);
 			break;
 	}
     return 0;
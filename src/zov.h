@@ -12,5 +12,7 @@
 #define DEFAULT_DIR "."
 #define VERSION "2.2.8"
 #define BUILD_DATE __DATE__
+#define MAX_THREADS 256
+#define PASSWORD_ENV "ZOV_PASSWORD"   /* --password reads it before asking */
 
 #endif